@@ -11,6 +11,8 @@
 #include <queue>
 #include <cstring>
 #include <numeric>
+#include <thread>
+#include <atomic>
 
 struct input_t {
 	char *s;
@@ -52,6 +54,74 @@ struct bits {
 	bits end() const                      { return 0; }
 };
 
+// Number of worker threads to use for n units of work, giving each
+// thread at least `grain` units
+static int worker_count(size_t n, size_t grain) {
+	size_t hw = std::max(1u, std::thread::hardware_concurrency());
+	return std::max<size_t>(1, std::min(hw, n / std::max<size_t>(grain, 1)));
+}
+
+// Split [0, n) into T contiguous chunks and call fn(t, begin, end) for
+// each on its own thread.  Chunk 0 runs on the calling thread.
+template<typename F>
+static void parallel_for(int T, size_t n, F fn) {
+	std::vector<std::thread> W;
+	for (int t = 1; t < T; t++) {
+		W.emplace_back(fn, t, n * t / T, n * (t + 1) / T);
+	}
+	fn(0, 0, n / T);
+	for (auto &w : W) w.join();
+}
+
+// Contiguous range of elements, e.g. one row of an adjacency list
+template<typename T>
+struct span {
+	T *b, *e;
+	T * begin() const { return b; }
+	T * end() const { return e; }
+	size_t size() const { return e - b; }
+	T & operator[] (size_t i) const { return b[i]; }
+};
+
+// Unbounded grid made of 16x16 tiles, allocated on first touch
+template<typename T>
+struct sparse_grid {
+	static constexpr int B = 4, M = (1 << B) - 1;
+	using tile_t = std::array<T, 1 << (2 * B)>;
+
+	std::unordered_map<uint64_t, uint32_t> page;
+	std::vector<tile_t> tiles;
+	uint64_t last_key = ~0ULL;
+	uint32_t last = 0;
+
+	static uint64_t key(int y, int x) {
+		return uint64_t(uint32_t(y >> B)) << 32 | uint32_t(x >> B);
+	}
+
+	static int offset(int y, int x) {
+		return (y & M) << B | (x & M);
+	}
+
+	// Access a cell, allocating its tile if necessary.  Walks tend to
+	// stay within the same tile, so remember the last one.
+	T & operator () (int y, int x) {
+		auto k = key(y, x);
+		if (k != last_key) {
+			auto [it, added] = page.try_emplace(k, tiles.size());
+			if (added) tiles.emplace_back();
+			last_key = k;
+			last = it->second;
+		}
+		return tiles[last][offset(y, x)];
+	}
+
+	// Read a cell without allocating
+	T get(int y, int x) const {
+		auto it = page.find(key(y, x));
+		return it == page.end() ? T() : tiles[it->second][offset(y, x)];
+	}
+};
+
 // Character recognition
 template<typename T, typename F>
 static char ocr(T *p, F test) {
@@ -89,6 +159,25 @@ static char ocr(T *p, F test) {
 
 std::vector<int64_t> read_intcode(input_t in);
 
+#ifdef STATS
+// Solver statistics, reported by main() after each day's answers.
+// VMs may run on worker threads, so each run() adds its count once.
+inline std::atomic<uint64_t> intcode_steps(0);
+inline std::string stats;
+
+template<typename... Args>
+static void stat(const char *fmt, Args... args) {
+	char buf[256];
+	snprintf(buf, sizeof(buf), fmt, args...);
+	stats += "        ";
+	stats += buf;
+	stats += '\n';
+}
+#else
+template<typename... Args>
+static void stat(const char *, Args...) { }
+#endif
+
 struct cpu_t {
 	std::vector<int64_t> V;
 	int64_t output = 0, *input = NULL;
@@ -100,9 +189,35 @@ struct cpu_t {
 		this->V.resize(V.size() + extra_mem);
 	}
 
+	// Restart from a saved memory image (a copy of V taken before
+	// running), reusing the allocation
+	void reset(const std::vector<int64_t> &image) {
+		std::copy(image.begin(), image.end(), V.begin());
+		i = r = 0;
+	}
+
+	// Become a copy of another VM, including a pending input request,
+	// reusing this one's allocation
+	void restore(const cpu_t &o) {
+		V.assign(o.V.begin(), o.V.end());
+		output = o.output;
+		input = o.input ? V.data() + (o.input - o.V.data()) : NULL;
+		i = o.i;
+		r = o.r;
+	}
+
 	// Potentially unsafe memory access, use only with official inputs
 	int run() {
+#ifdef STATS
+		struct tally {
+			uint64_t n = 0;
+			~tally() { intcode_steps.fetch_add(n, std::memory_order_relaxed); }
+		} steps;
+#endif
 		for (;;) {
+#ifdef STATS
+			steps.n++;
+#endif
 			auto &a = V[i + 1], &b = V[i + 2], &c = V[i + 3];
 			switch (V[i]) {
 			    case     1: V[  c] = V[  a] + V[  b];    i += 4; break;
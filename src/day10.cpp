@@ -2,8 +2,6 @@
 
 // Day 10: Monitoring Station
 
-constexpr int SZ = 50;
-
 namespace {
 
 struct pt {
@@ -14,6 +12,71 @@ struct pt {
 	pt operator - (const pt &o) const { return { y - o.y, x - o.x }; }
 };
 
+// Rays from the monitoring station in clockwise order starting from
+// straight up, indexed by number of asteroids intersected
+struct ray_index {
+	const std::vector<std::vector<bool>> &G;
+	pt station;
+	std::vector<pt> step;        // Grid step of each ray
+	std::vector<int> count;      // Asteroids intersected by each ray
+	std::vector<int> layer = { 0 }; // Asteroids vaporized through each rotation
+
+	ray_index(const std::vector<std::vector<bool>> &G, pt station, const std::vector<pt> &step) :
+		G(G), station(station), step(step), count(step.size())
+	{
+	}
+
+	// Summarize the ray counts after they are filled in
+	void index() {
+		// Number of rays with at least k asteroids
+		for (int c : count) {
+			if (c >= layer.size()) layer.resize(c + 1);
+			layer[c]++;
+		}
+		for (int k = layer.size() - 2; k > 0; k--) layer[k] += layer[k + 1];
+		// Cumulative asteroids vaporized after each rotation
+		layer[0] = 0;
+		std::partial_sum(layer.begin(), layer.end(), layer.begin());
+	}
+
+	// Locations of the N-th vaporized asteroids (1-based), or (-1,-1)
+	// if fewer than N asteroids are visible from any ray
+	std::vector<pt> vaporized(const std::vector<int> &N) const {
+		std::vector<pt> result(N.size(), pt(-1, -1));
+
+		std::vector<int> order(N.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return N[a] < N[b]; });
+
+		// One pass over the rays for each rotation containing a query
+		auto q = order.begin();
+		while (q != order.end() && N[*q] < 1) q++;
+		while (q != order.end()) {
+			int k = std::lower_bound(layer.begin(), layer.end(), N[*q]) - layer.begin();
+			if (k == layer.size()) break;
+			for (int r = 0, seen = layer[k - 1]; r < count.size(); r++) {
+				if (count[r] < k) continue;
+				for (++seen; q != order.end() && N[*q] == seen; q++) {
+					result[*q] = nth_on_ray(r, k);
+				}
+				if (q == order.end() || N[*q] > layer[k]) break;
+			}
+		}
+
+		return result;
+	}
+
+	// Location of the k-th asteroid along a ray
+	pt nth_on_ray(int r, int k) const {
+		pt f = station;
+		do {
+			f = f + step[r];
+			k -= G[f.y][f.x];
+		} while (k);
+		return f;
+	}
+};
+
 }
 
 // Generate a list of reduced fractions with numerator and denominator not exceeding n
@@ -33,6 +96,18 @@ static std::vector<pt> fracs(int n) {
 	return F;
 }
 
+// Rotate the first-quadrant fractions into each quadrant, giving the
+// grid step of every ray in clockwise order starting from straight up
+static std::vector<pt> rays(const std::vector<pt> &F) {
+	std::vector<pt> step;
+	step.reserve(4 * F.size());
+	for (auto f : F) step.emplace_back(-f.x,  f.y);
+	for (auto f : F) step.emplace_back( f.y,  f.x);
+	for (auto f : F) step.emplace_back( f.x, -f.y);
+	for (auto f : F) step.emplace_back(-f.y, -f.x);
+	return step;
+}
+
 output_t day10(input_t in) {
 	// Read in the map, saving it both as an array of booleans and
 	// a list of (y,x) coordinates
@@ -41,68 +116,86 @@ output_t day10(input_t in) {
 	for (int x = 0, y = 0; in.len--; in.s++) {
 		if (*in.s == '\n') {
 			G.emplace_back();
-			x = 0;
-			if (++y >= SZ) abort();
+			x = 0, y++;
 		} else if (*in.s != '\r') {
 			G.back().push_back(*in.s == '#');
 			if (*in.s == '#') P.emplace_back(y, x);
-			if (++x >= SZ) abort();
+			x++;
 		}
 	}
-	int DIM = G[0].size();
-	G.resize(DIM);
-	for (auto &g : G) g.resize(DIM);
-
-	// Make a reduced fraction lookup table (ex: 2/4 -> 1/2)
-	auto F = fracs(DIM);
-	int16_t Reduced[SZ][SZ] = { };
-	for (int i = 0; i < F.size(); i++) {
-		auto f = F[i];
-		for (auto g = f; g.y < DIM && g.x < DIM; g = g + f) {
-			Reduced[g.y][g.x] = i;
+	if (G.back().empty()) G.pop_back();
+	int H = G.size(), W = G[0].size();
+	for (auto &g : G) g.resize(W);
+
+	// Make a lookup table from (dy,dx) to the ray containing it, sized
+	// to the map.  The extra ray id is reserved for (0,0).
+	auto step = rays(fracs(std::max(H, W)));
+	int NR = step.size(), PITCH = 2 * W - 1;
+	std::vector<int> D((2 * H - 1) * PITCH);
+	int center = (H - 1) * PITCH + (W - 1);
+	D[center] = NR;
+	for (int r = 0; r < NR; r++) {
+		auto f = step[r];
+		for (auto g = f; abs(g.y) < H && abs(g.x) < W; g = g + f) {
+			D[center + g.y * PITCH + g.x] = r;
 		}
 	}
 
-	// Part 1: O(n^2) in the number of asteroids
-	int part1 = 0, which = 0;
-	std::array<std::bitset<2048>, 4> BEST = { };
-	for (int i = 0; i < P.size(); i++) {
-		int visible = P.size() - 1;
-		std::array<std::bitset<2048>, 4> B = { };
-		for (int j = 0; j < P.size(); j++) {
-			if (i == j) continue;
-			int dx = P[i].y - P[j].y;
-			int dy = P[j].x - P[i].x;
-			int quad = 0;
-			if (dy > 0 && dx <= 0) {
-				quad = 1;
-				dx = std::exchange(dy, -dx);
-			} else if (dx < 0 && dy <= 0) {
-				quad = 2;
-				dx = -dx, dy = -dy;
-			} else if (dx >= 0 && dy < 0) {
-				quad = 3;
-				dy = std::exchange(dx, -dy);
+	// Offset of each asteroid into the table; the ray from station i
+	// to asteroid j is then D[center - off[i] + off[j]]
+	std::vector<int> off;
+	off.reserve(P.size());
+	for (auto p : P) off.push_back(p.y * PITCH + p.x);
+
+	// Part 1: O(n^2) in the number of asteroids, split across threads
+	// by station.  Remember which ray each asteroid is on as seen from
+	// the best station.
+	struct best_t {
+		int visible = -1, which = 0;
+		std::vector<int> R;
+	};
+	int T = worker_count(P.size() * P.size(), 1 << 22);
+	std::vector<best_t> Best(T);
+
+	parallel_for(T, P.size(), [&](int t, size_t begin, size_t end) {
+		auto &best = Best[t];
+		std::vector<uint64_t> B(NR / 64 + 1);
+		std::vector<int> R(P.size());
+		for (int i = begin; i < end; i++) {
+			// Gather the ray ids first so this loop vectorizes
+			const int *Di = D.data() + center - off[i];
+			for (int j = 0; j < P.size(); j++) {
+				R[j] = Di[off[j]];
+			}
+			int visible = -1; // Don't count the station itself
+			for (int r : R) {
+				uint64_t bit = 1ULL << (r & 63);
+				visible += !(B[r >> 6] & bit);
+				B[r >> 6] |= bit;
+			}
+			for (int r : R) B[r >> 6] = 0;
+			if (best.visible < visible) {
+				best.visible = visible;
+				best.which = i;
+				best.R.swap(R);
+				R.resize(P.size());
 			}
-			int g = Reduced[dy][dx];
-			visible -= B[quad].test(g);
-			B[quad].set(g);
-		}
-		if (part1 < visible) {
-			part1 = visible;
-			which = i;
-			BEST = B;
 		}
-	}
+	});
+
+	auto &best = *std::max_element(Best.begin(), Best.end(),
+			[](auto &a, auto &b) { return a.visible < b.visible; });
+	int part1 = best.visible, which = best.which;
+	auto &BEST_R = best.R;
 
-	// The Part 2 asteroid is in Quadrant 3, Layer 1
-	int g = 0;
-	for (int i = 200 + BEST[3].count() - part1; i; g++) {
-		i -= BEST[3].test(g);
+	// Part 2: Index the rays by number of asteroids intersected
+	ray_index V(G, P[which], step);
+	for (int j = 0; j < P.size(); j++) {
+		if (j != which) V.count[BEST_R[j]]++;
 	}
-	pt step = F[g - 1];
-	pt f = P[which] - step;
-	for (; !G[f.y][f.x]; f = f - step) { }
+	V.index();
+
+	pt f = V.vaporized({ 200 })[0];
 	int part2 = f.x * 100 + f.y;
 
 	return { part1, part2 };
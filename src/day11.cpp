@@ -2,61 +2,48 @@
 
 // Day 11: Space Police
 
-using p2_t = bool[8][64];
+// Each panel stores its color in bit 0 and whether it was painted in bit 1
+using hull_t = sparse_grid<int8_t>;
 
-static bool test(bool *p, int y, int x) {
-	return p[64*y + x];
-}
-
-output_t day11(input_t in) {
-	auto V = read_intcode(in);
-
-	constexpr int DIM = 200;
-	int8_t G[DIM][DIM] = { };
-	int x = DIM / 2, y = DIM / 2;
-
-	cpu_t C1(V);
-	int part1 = 0, dy = -1, dx = 0;
+// Run the robot until it halts, returning the number of panels painted
+static int paint(const std::vector<int64_t> &V, hull_t &G) {
+	cpu_t C(V);
+	int painted = 0, y = 0, x = 0, dy = -1, dx = 0;
 	for (;;) {
-		if (C1.run() == cpu_t::S_HLT) break;
-		*C1.input = G[x][y] & 1;
-		part1 += !(G[x][y] & 2);
-		C1.run();
-		G[x][y] = 2 | C1.output;
-		C1.run();
-		if (C1.output) {
+		if (C.run() == cpu_t::S_HLT) break;
+		auto &g = G(y, x);
+		*C.input = g & 1;
+		C.run();
+		painted += !(g & 2);
+		g = 2 | C.output;
+		C.run();
+		if (C.output) {
 			dy = std::exchange(dx, -dy);
 		} else {
 			dx = std::exchange(dy, -dx);
 		}
 		x += dx, y += dy;
-		if (x < 0 || x >= DIM) abort();
-		if (y < 0 || y >= DIM) abort();
 	}
+	return painted;
+}
 
-	p2_t H = { };
-	H[0][0] = true;
-	y = 0, x = 0, dy = -1, dx = 0;
-	cpu_t C2(V);
-	for (;;) {
-		if (C1.run() == cpu_t::S_HLT) break;
-		*C1.input = H[y][x];
-		C1.run();
-		H[y][x] = C1.output;
-		C1.run();
-		if (C1.output) {
-			dy = std::exchange(dx, -dy);
-		} else {
-			dx = std::exchange(dy, -dx);
-		}
-		x += dx, y += dy;
-		if (x < 0 || x >= 64) abort();
-		if (y < 0 || y >= 8) abort();
-	}
+output_t day11(input_t in) {
+	auto V = read_intcode(in);
+
+	hull_t G1;
+	int part1 = paint(V, G1);
+
+	// Part 2: The robot may repaint any panel, so the letters can only
+	// be read once it halts
+	hull_t G2;
+	G2(0, 0) = 1;
+	paint(V, G2);
 
 	std::string part2;
-	for (int x = 1; x <= 40; x += 5) {
-		part2.push_back(ocr(&H[0][x], test));
+	for (int k = 0; k < 8; k++) {
+		part2.push_back(ocr(&k, [&](const int *k, int y, int x) {
+			return G2.get(y, 1 + 5 * *k + x) & 1;
+		}));
 	}
 
 	return { part1, part2 };
@@ -1,92 +1,295 @@
-#include <x86intrin.h>
+#include <chrono>
 #include "advent2019.h"
 
 // Day 12: The N-Body Problem
 
-using axis = std::array<int, 4>;
+namespace {
 
-static void step(__m64 &p, __m64 &v) {
-	// Find acceleration by making pairwise comparisons 
-	__m64 c0 = _mm_shuffle_pi16(p, 0x39); // 1, 2, 3, 0
-	__m64 c1 = _mm_shuffle_pi16(p, 0x4e); // 2, 3, 0, 1
-	__m64 c2 = _mm_shuffle_pi16(p, 0x93); // 3, 0, 1, 2
+#ifdef __AVX512F__
+constexpr int LANES = 16;
+#else
+constexpr int LANES = 8;
+#endif
 
-	c0 = _mm_sign_pi16(_mm_set1_pi16(1), _mm_sub_pi16(c0, p));
-	c1 = _mm_sign_pi16(_mm_set1_pi16(1), _mm_sub_pi16(c1, p));
-	c2 = _mm_sign_pi16(_mm_set1_pi16(1), _mm_sub_pi16(c2, p));
+typedef int32_t vec_t __attribute__ ((vector_size (4 * LANES)));
+typedef int16_t v16hi __attribute__ ((vector_size (32)));
+typedef int64_t v4di  __attribute__ ((vector_size (32)));
 
-	// Update velocity
-	v = _mm_add_pi16(v, c0);
-	v = _mm_add_pi16(v, c1);
-	v = _mm_add_pi16(v, c2);
+// Starting positions, one vector per axis
+using axes = std::array<std::vector<int>, 3>;
+
+// Exactly four bodies with all three axes packed into one register
+// as 16-bit lanes: { x0..x3, y0..y3, z0..z3, unused }
+struct four_body {
+	// Splitting the axes across threads saves no work
+	static constexpr bool PACKED = true;
+
+	v16hi p = { }, v = { };
+	int mask;
+	int64_t steps = 0;
+
+	four_body(const axes &P, const axes &V, int mask = 7) : mask(mask) {
+		for (int k : bits(mask)) {
+			for (int i = 0; i < 4; i++) {
+				p[4 * k + i] = P[k][i];
+				v[4 * k + i] = V[k][i];
+			}
+		}
+	}
+
+	void step() {
+		// Find acceleration by making pairwise comparisons
+		v16hi c0 = __builtin_shufflevector(p, p, 1,2,3,0, 5,6,7,4, 9,10,11,8, 13,14,15,12);
+		v16hi c1 = __builtin_shufflevector(p, p, 2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13);
+		v16hi c2 = __builtin_shufflevector(p, p, 3,0,1,2, 7,4,5,6, 11,8,9,10, 15,12,13,14);
+
+		// Update velocity, then position
+		v += (p > c0) - (c0 > p);
+		v += (p > c1) - (c1 > p);
+		v += (p > c2) - (c2 > p);
+		p += v;
+		steps++;
+	}
+
+	// Bitmask of axes on which every body is at rest
+	int stopped() const {
+		v4di w = (v4di) v;
+		return ((w[0] == 0) | (w[1] == 0) << 1 | (w[2] == 0) << 2) & mask;
+	}
+
+	// Axes not in the mask are always zero
+	bool operator == (const four_body &o) const {
+		v4di d = (v4di) ((p ^ o.p) | (v ^ o.v));
+		return !(d[0] | d[1] | d[2]);
+	}
+
+	int64_t energy() const {
+		int64_t e = 0;
+		for (int i = 0; i < 4; i++) {
+			e += (abs(p[i]) + abs(p[4 + i]) + abs(p[8 + i])) *
+				(abs(v[i]) + abs(v[4 + i]) + abs(v[8 + i]));
+		}
+		return e;
+	}
+};
+
+// Any number of bodies, stored one array per axis and padded to a whole
+// number of register blocks.  Every axis in `mask` advances in the same
+// pass over the bodies.
+struct n_body {
+	static constexpr bool PACKED = false;
+	static constexpr int IB = 2;     // Vectors per register block
+	static constexpr int JT = 1024;  // Bodies per cache tile
+
+	int N, NV, mask;
+	int64_t steps = 0;
+	std::array<std::vector<vec_t>, 3> p, v, a;
+	std::vector<vec_t> valid;
+
+	n_body(const axes &P, const axes &V, int mask = 7) : N(P[0].size()), mask(mask) {
+		NV = (N + IB * LANES - 1) / (IB * LANES) * IB;
+		for (int k : bits(mask)) {
+			p[k].resize(NV), v[k].resize(NV), a[k].resize(NV);
+			for (int i = 0; i < N; i++) {
+				p[k][i / LANES][i % LANES] = P[k][i];
+				v[k][i / LANES][i % LANES] = V[k][i];
+			}
+		}
+		valid.resize(NV);
+		for (int i = 0; i < N; i++) valid[i / LANES][i % LANES] = -1;
+	}
+
+	void step() {
+		for (int k : bits(mask)) std::fill(a[k].begin(), a[k].end(), vec_t{});
+
+		// Pairwise sign accumulation, blocked so that a tile of bodies
+		// stays in cache while each block of accumulators stays in
+		// registers
+		for (int jt = 0; jt < N; jt += JT) {
+			int je = std::min(N, jt + JT);
+			for (int ib = 0; ib < NV; ib += IB) {
+				vec_t pi[3][IB], acc[3][IB];
+				for (int k : bits(mask)) {
+					for (int b = 0; b < IB; b++) {
+						pi[k][b] = p[k][ib + b];
+						acc[k][b] = a[k][ib + b];
+					}
+				}
+				for (int j = jt; j < je; j++) {
+					for (int k : bits(mask)) {
+						vec_t pj = vec_t{} + p[k][j / LANES][j % LANES];
+						for (int b = 0; b < IB; b++) {
+							acc[k][b] += (pi[k][b] > pj) - (pj > pi[k][b]);
+						}
+					}
+				}
+				for (int k : bits(mask)) {
+					for (int b = 0; b < IB; b++) a[k][ib + b] = acc[k][b];
+				}
+			}
+		}
+
+		// Update velocity, then position; padding bodies stay at rest
+		for (int k : bits(mask)) {
+			for (int i = 0; i < NV; i++) {
+				v[k][i] += a[k][i] & valid[i];
+				p[k][i] += v[k][i];
+			}
+		}
+		steps++;
+	}
+
+	// Bitmask of axes on which every body is at rest
+	int stopped() const {
+		int z = 0;
+		for (int k : bits(mask)) {
+			vec_t any = { };
+			for (auto &x : v[k]) any |= x;
+			bool rest = true;
+			for (int l = 0; l < LANES; l++) rest &= !any[l];
+			z |= rest << k;
+		}
+		return z;
+	}
+
+	bool operator == (const n_body &o) const {
+		for (int k : bits(mask)) {
+			vec_t d = { };
+			for (int i = 0; i < NV; i++) {
+				d |= (p[k][i] ^ o.p[k][i]) | (v[k][i] ^ o.v[k][i]);
+			}
+			for (int l = 0; l < LANES; l++) {
+				if (d[l]) return false;
+			}
+		}
+		return true;
+	}
+
+	int64_t energy() const {
+		int64_t e = 0;
+		for (int i = 0; i < N; i++) {
+			int64_t pot = 0, kin = 0;
+			for (int k = 0; k < 3; k++) {
+				pot += abs(p[k][i / LANES][i % LANES]);
+				kin += abs(v[k][i / LANES][i % LANES]);
+			}
+			e += pot * kin;
+		}
+		return e;
+	}
+};
 
-	// Update position
-	p = _mm_add_pi16(p, v);
 }
 
 // Simulate 1000 steps
-static std::pair<axis,axis> solve_part1(axis A) {
-	__m64 p = _mm_set_pi16(A[0], A[1], A[2], A[3]);
-	__m64 v = _mm_setzero_si64();
+template<typename Sim>
+static int64_t solve_part1(Sim S) {
 	for (int i = 0; i < 1000; i++) {
-		step(p, v);
-	}
-	p = _mm_abs_pi16(p);
-	v = _mm_abs_pi16(v);
-
-	axis P, V;
-	P[0] = _mm_extract_pi16(p, 0);
-	P[1] = _mm_extract_pi16(p, 1);
-	P[2] = _mm_extract_pi16(p, 2);
-	P[3] = _mm_extract_pi16(p, 3);
-	V[0] = _mm_extract_pi16(v, 0);
-	V[1] = _mm_extract_pi16(v, 1);
-	V[2] = _mm_extract_pi16(v, 2);
-	V[3] = _mm_extract_pi16(v, 3);
-
-	return { P, V };
+		S.step();
+	}
+	return S.energy();
 }
 
-// Simulate until velocity of all objects is zero again,
-// then double the number of steps taken
-static int64_t cycle_len(axis A) {
-	__m64 p = _mm_set_pi16(A[0], A[1], A[2], A[3]);
-	__m64 v = _mm_setzero_si64();
-	int64_t cycle = 0;
-	do {
-		step(p, v);
-		cycle++;
-	} while (_mm_cvtm64_si64(v));
-	return cycle * 2;
+// For each axis, simulate until velocity of all objects is zero again,
+// then double the number of steps taken.  Only valid when starting at rest.
+template<typename Sim, typename F>
+static void half_cycle(Sim &S, F found) {
+	for (int todo = S.mask; todo; ) {
+		S.step();
+		for (int k : bits(S.stopped() & todo)) {
+			found(k, S.steps * 2);
+			todo ^= 1 << k;
+		}
+	}
+}
+
+// Brent's cycle detection, for any starting state.  The simulation is
+// reversible, so the cycle always returns to the starting state and
+// only its length needs to be found.
+template<typename Sim>
+static int64_t brent(Sim &S) {
+	Sim T = S;
+	S.step();
+	for (int64_t power = 1, lambda = 1; ; lambda++) {
+		if (S == T) return lambda;
+		if (power == lambda) {
+			T = S;
+			power *= 2;
+			lambda = 0;
+		}
+		S.step();
+	}
+}
+
+// Find the cycle length of each axis; the answer is their least common
+// multiple.  Unless all axes share a register, each axis gets its own
+// thread.
+template<typename Sim>
+static int64_t solve_part2(const axes &P, const axes &V) {
+	std::array<int64_t, 3> cycle, steps;
+	std::array<double, 3> elapsed;
+	auto t0 = std::chrono::steady_clock::now();
+	auto done = [&](int k, int64_t c, int64_t n) {
+		cycle[k] = c, steps[k] = n;
+		elapsed[k] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	};
+
+	auto at_rest = [](auto &v) { return std::all_of(v.begin(), v.end(), [](int x) { return !x; }); };
+	if (Sim::PACKED && std::all_of(V.begin(), V.end(), at_rest)) {
+		Sim S(P, V);
+		half_cycle(S, [&](int k, int64_t c) { done(k, c, S.steps); });
+	} else {
+		parallel_for(3, 3, [&](int k, size_t, size_t) {
+			Sim S(P, V, 1 << k);
+			if (at_rest(V[k])) {
+				half_cycle(S, [&](int k, int64_t c) { done(k, c, S.steps); });
+			} else {
+				int64_t c = brent(S);
+				done(k, c, S.steps);
+			}
+		});
+	}
+
+	int64_t part2 = 1;
+	for (int k = 0; k < 3; k++) {
+		part2 *= cycle[k] / std::gcd(part2, cycle[k]);
+		stat("axis %c: %ld steps, %.3g steps/s", 'x' + k, steps[k], steps[k] / elapsed[k]);
+	}
+	return part2;
 }
 
 output_t day12(input_t in) {
-	std::array<axis, 3> A, P, V;
-
-#define FMT "<x=%d, y=%d, z=%d>\n"
-	sscanf(in.s, FMT FMT FMT FMT,
-			&A[0][0], &A[1][0], &A[2][0],
-			&A[0][1], &A[1][1], &A[2][1],
-			&A[0][2], &A[1][2], &A[2][2],
-			&A[0][3], &A[1][3], &A[2][3]);
-#undef FMT
-
-	int64_t part1 = 0;
-	for (int i = 0; i < 3; i++) {
-		auto [ p, v ] = solve_part1(A[i]);
-		P[i] = p;
-		V[i] = v;
-	}
-	for (int i = 0; i < 4; i++) {
-		part1 += (P[0][i] + P[1][i] + P[2][i]) *
-			(V[0][i] + V[1][i] + V[2][i]);
-	}
-
-	int64_t a = cycle_len(A[0]);
-	int64_t b = cycle_len(A[1]);
-	int64_t c = cycle_len(A[2]);
-	int64_t part2 = a * b / std::gcd(a, b);
-	part2 *= c / std::gcd(part2, c);
+	// Read "<x=..., y=..., z=...>" lines for any number of bodies.
+	// Also accepts "pos=<...>, vel=<...>" lines with starting velocities.
+	axes P, V;
+	for (int n = 0, neg = 0, k = 0, num = 0, vel = 0; in.len--; in.s++) {
+		uint8_t c = *in.s - '0';
+		if (c < 10) {
+			n = 10 * n + c;
+			num = 1;
+		} else if (*in.s == '-') {
+			neg = 1;
+		} else if (*in.s == 'v') {
+			vel = 1;
+		} else if (*in.s == '\n') {
+			vel = 0;
+		} else if (num) {
+			(vel ? V : P)[k].push_back(neg ? -n : n);
+			k = (k + 1) % 3;
+			n = neg = num = 0;
+		}
+	}
+
+	for (int k = 0; k < 3; k++) V[k].resize(P[k].size());
+
+	int64_t part1, part2;
+	if (P[0].size() == 4) {
+		part1 = solve_part1(four_body(P, V));
+		part2 = solve_part2<four_body>(P, V);
+	} else {
+		part1 = solve_part1(n_body(P, V));
+		part2 = solve_part2<n_body>(P, V);
+	}
 
 	return { part1, part2 };
 }
@@ -4,42 +4,65 @@
 
 enum { G_EMPTY, G_WALL, G_BLOCK, G_PADDLE, G_BALL };
 
-output_t day13(input_t in) {
-	auto V = read_intcode(in);
+namespace {
 
-	int part1 = 0;
-	cpu_t C1(V);
-	for (;;) {
-		int s = C1.run();
-		if (s == cpu_t::S_HLT) break;
-		C1.run();
-		C1.run();
-		part1 += (C1.output == G_BLOCK);
-	}
+// Headless game driver which only tracks the score, ball and paddle
+struct breakout {
+	cpu_t C;
+	int score = 0, ball = 0, paddle = 0;
 
-	// No tricks, just play the game
-	int part2 = 0;
-	V[0] = 2;
-	cpu_t C2(V);
-	for (int p = 0, b = 0; ; ) {
-		int s = C2.run();
-		if (s == cpu_t::S_HLT) break;
-		if (s == cpu_t::S_IN) {
-			*C2.input = (b < p) ? -1 : (b > p);
-		} else {
-			int x = C2.output;
-			C2.run();
-			C2.run();
-			int t = C2.output;
+	breakout(std::vector<int64_t> V) : C((V[0] = 2, V)) { }
+
+	// Run until the game asks for input or halts, consuming the draw
+	// commands in batches of three outputs.  Returns false on halt.
+	// on_tile(x, tile) sees every tile drawn.
+	template<typename F>
+	bool frame(F on_tile) {
+		int s;
+		while ((s = C.run()) == cpu_t::S_OUT) {
+			int x = C.output;
+			C.run();
+			C.run();
+			int t = C.output;
 			if (x == -1) {
-				part2 = t;
-			} else if (t == G_BALL) {
-				b = x;
-			} else if (t == G_PADDLE) {
-				p = x;
+				score = t;
+			} else {
+				ball   = (t == G_BALL)   ? x : ball;
+				paddle = (t == G_PADDLE) ? x : paddle;
+				on_tile(x, t);
 			}
 		}
+		return s == cpu_t::S_IN;
+	}
+
+	bool frame() {
+		return frame([](int, int) { });
+	}
+
+	// Follow the ball with the paddle
+	void joystick() {
+		*C.input = (ball < paddle) ? -1 : (ball > paddle);
+	}
+};
+
+}
+
+output_t day13(input_t in) {
+	breakout B(read_intcode(in));
+
+	// Part 1: The first frame of the game draws the same screen as the
+	// free play mode, so there's no need to run the program twice
+	int part1 = 0;
+	bool playing = B.frame([&](int, int t) {
+		part1 += (t == G_BLOCK);
+	});
+
+	// No tricks, just play the game
+	while (playing) {
+		B.joystick();
+		playing = B.frame();
 	}
+	int part2 = B.score;
 
 	return { part1, part2 };
 }
@@ -1,103 +1,163 @@
+#include <string_view>
 #include "advent2019.h"
 
 // Day 14: Space Stoichiometry
 
-using ID = std::string;
-
 namespace {
 
-struct pile {
-	ID id;
-	int64_t n;
-	pile() : id(), n() { }
-	pile(ID id, int64_t n) : id(id), n(n) { }
-};
-
-struct recipe {
-	std::vector<pile> in;
-	pile out;
-	bool mark;
-	recipe() : in(), out(), mark() { }
-};
+// Reactions with chemicals numbered in topological order (FUEL first,
+// ORE last), and recipe inputs stored as compressed sparse rows
+struct reactions {
+	std::vector<int64_t> out;   // Units produced by each reaction
+	std::vector<int> start;     // Offset of each reaction's inputs
+	std::vector<int> in_id;
+	std::vector<int64_t> in_n;
+	int ore = 0;
+
+	// Scratch space for cost(), so that it does not allocate
+	mutable std::vector<int64_t> need;
+
+	reactions(input_t in);
+
+	// Cost to synthesize 'fuel' units of fuel
+	int64_t cost(int64_t fuel) const {
+		std::fill(need.begin(), need.end(), 0);
+		need[0] = fuel;
+		for (int id = 0; id < ore; id++) {
+			int64_t n = (need[id] + out[id] - 1) / out[id];
+			for (int e = start[id]; e < start[id + 1]; e++) {
+				need[in_id[e]] += n * in_n[e];
+			}
+		}
+		return need[ore];
+	}
 
-}
+	// Maximum fuel that can be made from each of the given amounts of
+	// ore, which must be sorted.  Probes are shared between budgets.
+	std::vector<int64_t> max_fuel(const std::vector<int64_t> &Budget) const {
+		std::vector<int64_t> Fuel(Budget.size());
+		if (Budget.empty()) return Fuel;
 
-using rmap_t = std::unordered_map<ID, recipe>;
+		int64_t hi = std::max<int64_t>(2, Budget.back() / cost(1) * 2), hi_ore;
+		while ((hi_ore = cost(hi)) <= Budget.back()) hi *= 2;
+		search(Budget, Fuel, 0, Budget.size(), 0, 0, hi, hi_ore);
 
-// Topological sort, DFS starting at 'id'
-static void topo(std::vector<ID> &T, rmap_t &Recipe, ID id) {
-	auto &r = Recipe[id];
-	if (r.mark) return;
-	r.mark = true;
-	for (auto p : r.in) topo(T, Recipe, p.id);
-	T.push_back(id);
-}
+		return Fuel;
+	}
 
-// Cost to synthesize 'fuel' units of fuel
-static int64_t cost(const std::vector<ID> &T, const rmap_t &Recipe, int64_t fuel) {
-	std::unordered_map<ID, int64_t> Need;
-	Need["FUEL"] = fuel;
-	for (auto id : T) {
-		if (id == "ORE") break;
-		auto &r = Recipe.find(id)->second;
-		int64_t n = (Need[id] + r.out.n - 1) / r.out.n;
-		for (auto &p : r.in) {
-			Need[p.id] += n * p.n;
+private:
+	// Interpolation search for all budgets in [i, j), which are known to
+	// satisfy cost(lo) <= budget < cost(hi).  Each probe splits the
+	// budgets into those below and above its cost.
+	void search(const std::vector<int64_t> &Budget, std::vector<int64_t> &Fuel,
+			int i, int j, int64_t lo, int64_t lo_ore, int64_t hi, int64_t hi_ore) const
+	{
+		while (i < j) {
+			if (lo == hi - 1) {
+				std::fill(Fuel.begin() + i, Fuel.begin() + j, lo);
+				return;
+			}
+
+			// Aim for the median budget
+			int m = (i + j) / 2;
+			double p = double(Budget[m] - lo_ore) / (hi_ore - lo_ore);
+
+			int64_t fuel = lo + p * (hi - lo);
+			fuel = std::min(fuel, hi - 1);
+			fuel = std::max(fuel, lo + 1);
+
+			int64_t ore = cost(fuel);
+
+			int k = std::lower_bound(Budget.begin() + i, Budget.begin() + j, ore) - Budget.begin();
+			search(Budget, Fuel, i, k, lo, lo_ore, fuel, ore);
+			i = k, lo = fuel, lo_ore = ore;
 		}
 	}
-	return Need["ORE"];
-}
+};
 
-output_t day14(input_t in) {
-	rmap_t Recipe;
+}
 
-	std::string id;
-	recipe R;
+reactions::reactions(input_t in) {
+	// Intern chemical names to dense IDs in order of appearance
+	std::unordered_map<std::string_view, int> Name;
+	auto intern = [&](std::string_view s) {
+		return Name.emplace(s, Name.size()).first->second;
+	};
+	const int FUEL = intern("FUEL"), ORE = intern("ORE");
+
+	// Reactions as read, indexed by the ID of their output
+	std::vector<int> R_start = { 0 }, R_of, R_id;
+	std::vector<int64_t> R_out, R_n;
+	const char *id = NULL;
 	for (int n = 0; in.len--; in.s++) {
 		uint8_t c = *in.s - '0';
 		if (c < 10) {
 			n = 10 * n + c;
 		} else if (*in.s >= 'A') {
-			id.push_back(*in.s);
-		} else if (*in.s == ',' || *in.s == '=') {
-			R.in.emplace_back(id, n);
-			n = 0, id.clear();
-		} else if (*in.s == '\n') {
-			R.out = { id, n };
-			Recipe[id] = R;
-			n = 0, id.clear(), R = { };
+			if (!id) id = in.s;
+		} else if (id) {
+			int k = intern({ id, size_t(in.s - id) });
+			id = NULL;
+			if (*in.s == ',' || (*in.s == ' ' && in.s[1] == '=')) {
+				R_id.push_back(k);
+				R_n.push_back(n);
+			} else {
+				if (k >= R_of.size()) R_of.resize(k + 1, -1);
+				R_of[k] = R_out.size();
+				R_out.push_back(n);
+				R_start.push_back(R_id.size());
+			}
+			n = 0;
+		}
+	}
+	R_of.resize(Name.size(), -1);
+
+	// Topological sort, iterative DFS starting at FUEL
+	std::vector<int> T, Mark(Name.size());
+	std::vector<std::pair<int,int>> S = { { FUEL, R_start[R_of[FUEL]] } };
+	Mark[FUEL] = 1;
+	while (!S.empty()) {
+		auto &[k, e] = S.back();
+		if (k != ORE && e < R_start[R_of[k] + 1]) {
+			int next = R_id[e++];
+			if (!Mark[next]) {
+				Mark[next] = 1;
+				S.emplace_back(next, next == ORE ? 0 : R_start[R_of[next]]);
+			}
+		} else {
+			if (k != ORE) T.push_back(k);
+			S.pop_back();
 		}
 	}
-
-	std::vector<ID> T;
-	topo(T, Recipe, "FUEL");
 	std::reverse(T.begin(), T.end());
+	T.push_back(ORE);
+
+	// Renumber in topological order
+	std::vector<int> Order(Name.size());
+	for (int i = 0; i < T.size(); i++) Order[T[i]] = i;
+
+	ore = T.size() - 1;
+	start = { 0 };
+	for (int i = 0; i < ore; i++) {
+		int r = R_of[T[i]];
+		out.push_back(R_out[r]);
+		for (int e = R_start[r]; e < R_start[r + 1]; e++) {
+			in_id.push_back(Order[R_id[e]]);
+			in_n.push_back(R_n[e]);
+		}
+		start.push_back(in_id.size());
+	}
+	need.resize(T.size());
+}
+
+output_t day14(input_t in) {
+	reactions R(in);
 
 	// One unit of fuel
-	int64_t part1 = cost(T, Recipe, 1);
+	int64_t part1 = R.cost(1);
 
 	// Interpolation search for part 2
-	int64_t supply = 1000000000000;
-	int64_t lo = 1, hi = (supply / part1) * 4;
-	int64_t lo_ore = part1, hi_ore = cost(T, Recipe, hi);
-	while (lo < hi - 1) {
-		double p = double(supply - lo_ore) / (hi_ore - lo_ore);
-
-		int64_t fuel = lo + p * (hi - lo);
-		fuel = std::min(fuel, hi - 1);
-		fuel = std::max(fuel, lo + 1);
-
-		int64_t ore = cost(T, Recipe, fuel);
-
-		if (ore == supply) {
-			lo = fuel;
-		} else if (ore < supply) {
-			lo = fuel, lo_ore = ore;
-		} else {
-			hi = fuel, hi_ore = ore;
-		}
-	}
-	int64_t part2 = lo;
+	int64_t part2 = R.max_fuel({ 1000000000000 })[0];
 
 	return { part1, part2 };
 }
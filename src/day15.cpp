@@ -3,48 +3,87 @@
 // Day 15: Oxygen System
 
 enum { NORTH, SOUTH, WEST, EAST };
+enum { UNKNOWN, WALL, OPEN, OXYGEN };
 
-static int move(cpu_t &C, int dir) {
-	C.run();
-	*C.input = dir + 1;
-	C.run();
-	return C.output;
-}
+static constexpr int DY[] = { -1, 1, 0, 0 };
+static constexpr int DX[] = { 0, 0, -1, 1 };
+
+namespace {
+
+struct explorer {
+	cpu_t C;
+	sparse_grid<int8_t> G;
+	int moves = 0;
+	int oy = 0, ox = 0;
+
+	explorer(input_t in) : C(read_intcode(in)) {
+		G(0, 0) = OPEN;
+	}
+
+	int move(int dir) {
+		moves++;
+		C.run();
+		*C.input = dir + 1;
+		C.run();
+		return C.output;
+	}
+
+	int record(int y, int x, int status) {
+		int cell = status + WALL;
+		if (cell == OXYGEN) oy = y, ox = x;
+		return G(y, x) = cell;
+	}
 
-static std::pair<int,int> solve(cpu_t &C, int back, int o2dist) {
-	// max_branch: maximum depth of non-oxygen children
-	// max_spread: maximum oxygen spread radius found so far
-	int max_branch = 0, max_spread = 0;
-
-	for (int dir = 0; dir < 4; dir++) {
-		/* Skip if wall or backtrack.  A further optimization
-		 * would be to remember the locations of walls, but the
-		 * simplicity of this algorithm is too nice.
-		 */
-		if (dir == back || !move(C, dir)) continue;
-
-		auto [ o, m ] = solve(C, dir ^ 1, move(C, dir) & 2);
-		if (o) {
-			o2dist = o + 2;
-			max_spread = m;
-		} else {
-			max_branch = std::max(max_branch, m + 2);
+	// The maze is made of rooms two steps apart, joined by corridors.
+	// Every corridor and room is probed only once; walls are never
+	// probed again from the other side.
+	void explore(int y, int x) {
+		for (int dir = 0; dir < 4; dir++) {
+			int cy = y + DY[dir], cx = x + DX[dir];
+			if (G.get(cy, cx) != UNKNOWN) continue;
+			if (record(cy, cx, move(dir)) == WALL) continue;
+
+			int ry = cy + DY[dir], rx = cx + DX[dir];
+			if (G.get(ry, rx) == UNKNOWN) {
+				record(ry, rx, move(dir));
+				explore(ry, rx);
+				move(dir ^ 1);
+			}
+			move(dir ^ 1);
 		}
+	}
 
-		move(C, dir ^ 1);
-		move(C, dir ^ 1);
+	// Breadth-first search of the recorded map from the oxygen system;
+	// returns the distance to the start and to the farthest cell
+	std::pair<int,int> spread() const {
+		sparse_grid<int> D;
+		std::vector<std::pair<int,int>> Q = { { oy, ox } };
+		D(oy, ox) = 1;
+		int dist = 0;
+		for (size_t q = 0; q < Q.size(); q++) {
+			auto [ y, x ] = Q[q];
+			dist = D(y, x);
+			for (int dir = 0; dir < 4; dir++) {
+				int ny = y + DY[dir], nx = x + DX[dir];
+				if (G.get(ny, nx) > WALL && !D.get(ny, nx)) {
+					D(ny, nx) = dist + 1;
+					Q.emplace_back(ny, nx);
+				}
+			}
+		}
+		return { D.get(0, 0) - 1, dist - 1 };
 	}
+};
 
-	return { o2dist, std::max(max_spread, o2dist + max_branch) };
 }
 
 output_t day15(input_t in) {
-	cpu_t C(read_intcode(in));
+	explorer E(in);
+	E.explore(0, 0);
 
-	auto [ o2dist, max_spread ] = solve(C, -1, 0);
+	auto [ part1, part2 ] = E.spread();
 
-	int part1 = o2dist - 2;
-	int part2 = max_spread - 2;
+	stat("%d moves", E.moves);
 
 	return { part1, part2 };
 }
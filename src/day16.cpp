@@ -1,3 +1,5 @@
+#include <climits>
+#include <cmath>
 #include "advent2019.h"
 
 // Day 16: Flawed Frequency Transmission
@@ -17,75 +19,199 @@ using int_t = int8_t;
 constexpr int PHASES = 100;
 constexpr int P2_REPEAT = 10000;
 
-output_t day16(input_t in) {
-	std::vector<int> V1 = { 0 };
-	std::vector<int_t> V2;
-	V1.reserve(in.len);
-	V2.reserve(in.len);
-	for (; in.len--; in.s++) {
-		uint8_t c = *in.s - '0';
-		if (c < 10) {
-			V1.push_back(c);
-			V2.push_back(c);
+// Longest signal the phase kernel transforms, which keeps its int sums
+// from overflowing and bounds its memory to about 5 bytes per digit
+constexpr int64_t MAX_DIGITS = INT_MAX / 9;
+
+// Part 2 without the combinatorial shortcut stores and transforms the
+// whole suffix after the message, so it is given a smaller budget
+constexpr int64_t MAX_SUFFIX = 1 << 26;
+
+namespace {
+
+// One phase over N digits starting at row `first` of the pattern; row i
+// has period 4(i+1).  Digits before `first` never affect the digits at
+// or after it, so any suffix of a signal can be transformed on its own.
+//
+// When starting from the beginning, the first K rows have short periods
+// and are computed from column sums over blocks of M digits, where M is
+// a multiple of every one of their periods.  That is one vectorizable
+// pass over the signal plus K dot products of length M.
+//
+// The remaining rows add and subtract contiguous regions of a prefix sum
+// array, O(n/i) each, and are split across threads.
+struct fft_phase {
+	int64_t N, first;
+	int K, M, T;
+	std::vector<int> P, S;
+	std::vector<int_t> W;
+	std::vector<int64_t> Bound;
+
+	fft_phase(int64_t N, int64_t first = 0) : N(N), first(first), K(0), M(1) {
+		// Choose K to minimize the estimated work; row i costs about
+		// N/(i+1) using prefix sums
+		double best = 0, harmonic = 0;
+		for (int k = 1, m = 1; !first && k <= 12; k++) {
+			m = std::lcm(m, 4 * k);
+			harmonic += 1.0 / k;
+			double saved = N * harmonic - (N / 4 + double(k) * m);
+			if (best < saved) best = saved, K = k, M = m;
 		}
+
+		// Pattern weights for the short rows
+		const int base[4] = { 0, 1, 0, -1 };
+		W.resize(K * M);
+		for (int i = 0; i < K; i++) {
+			for (int j = 0; j < M; j++) {
+				W[i * M + j] = base[((j + 1) / (i + 1)) % 4];
+			}
+		}
+		S.resize(M);
+		P.resize(N + 1);
+
+		// Split the long rows so each thread has about the same work
+		double lo = first + K + 1, hi = first + N + 1;
+		T = worker_count(N * (1 + log(hi / lo)), 1 << 17);
+		for (int t = 0; t <= T; t++) {
+			Bound.push_back(lo * pow(hi / lo, double(t) / T) - (first + 1));
+		}
+		Bound.back() = N;
 	}
-	int N = V2.size();
 
-	// Part 1: Use prefix sum array, O(n log n) per phase
-	V1.resize((V1.size() - 1) + 1);
-	for (int e = 0; e < PHASES; e++) {
-		for (int sum = 0, i = 0; i < V1.size(); i++) {
-			sum += V1[i];
-			V1[i] = sum;
+	void operator () (std::vector<int_t> &D) {
+		// Prefix sums and column sums of the current digits
+		for (int64_t i = 0; i < N; i++) P[i + 1] = P[i] + D[i];
+		std::fill(S.begin(), S.end(), 0);
+		int64_t b = 0;
+		for (; K && b + M <= N; b += M) {
+			for (int j = 0; j < M; j++) S[j] += D[b + j];
 		}
-		for (int i = 0, save = 0; i < N; i++) {
-			std::swap(save, V1[i]);
+		for (int j = 0; K && b + j < N; j++) S[j] += D[b + j];
 
-			// Add/subtract contiguous regions of the array
+		// Every output digit depends only on P and S, so the digits can
+		// be overwritten in place
+		for (int i = 0; i < std::min<int64_t>(K, N); i++) {
 			int sum = 0;
-			for (int k = i; k < N; ) {
-				int k1 = std::min(k + (i + 1), N);
-				sum = V1[k1] - V1[k] - sum;
-				k = k1 + (i + 1);
-			}
-
-			V1[i] = std::exchange(save, V1[i + 1]);
-			V1[i + 1] = std::abs(sum) % 10;
+			for (int j = 0; j < M; j++) sum += S[j] * W[i * M + j];
+			D[i] = std::abs(sum) % 10;
 		}
+		parallel_for(T, T, [&](int t, size_t, size_t) {
+			for (int64_t i = std::max<int64_t>(K, Bound[t]); i < Bound[t + 1]; i++) {
+				// Add/subtract contiguous regions of the array
+				int sum = 0;
+				int64_t len = first + i + 1;
+				for (int64_t k = i; k < N; ) {
+					int64_t k1 = std::min(k + len, N);
+					sum = P[k1] - P[k] - sum;
+					k = k1 + len;
+				}
+				D[i] = std::abs(sum) % 10;
+			}
+		});
 	}
-	int part1 = 0;
-	for (int i = 1; i < 9; i++) part1 = 10 * part1 + V1[i];
+};
 
-	int part2 = 0, offset = 0;
-	for (int i = 0; i < 7; i++) offset = 10 * offset + V2[i];
-	int tail = P2_REPEAT * N - offset;
+}
 
-	// Part 2: Solve digit-by-digit combinatorially
+// Part 2 when the message is in the second half of the signal: solve
+// digit-by-digit combinatorially, reading the repeated signal in place
+static int combinatorial(const std::vector<int_t> &V2, int64_t offset, int64_t total) {
+	int64_t N = V2.size(), tail = total - offset;
+	int part2 = 0;
+
+	// Whole periods of the coefficients and the signal together add
+	// nothing: an even number of the mod-2 terms (period 128) and five
+	// of the mod-5 terms (period 125); 83200 and 16250 when N is 650
+	int64_t P2 = 2 * std::lcm<int64_t>(128, N), P5 = 5 * std::lcm<int64_t>(125, N);
 	for (int d = 0; d < 8; d++) {
-		int sum = 0, idx0 = (offset + d) % N;
+		int sum = 0;
+		int64_t idx0 = (offset + d) % N;
 		for (int ofs = 0; ofs < 32; ofs += 4) {
-			int todo = tail - (d + ofs);
-			int skip = todo - (todo % 83200);
-			for (int i = d + ofs + skip, idx = idx0 + ofs; i < tail; i += 128, idx += 128) {
+			int64_t todo = tail - (d + ofs);
+			int64_t skip = todo - (todo % P2);
+			for (int64_t i = d + ofs + skip, idx = idx0 + ofs; i < tail; i += 128, idx += 128) {
 				idx -= N & -(idx >= N);
 				sum ^= V2[idx];
 			}
 		}
 		sum = (sum % 2) * 5;
-		int todo = tail - (d + 0);
-		int skip = todo - (todo % 16250);
-		for (int i = d + skip, idx = idx0; i < tail; i += 125, idx += 125) {
+		int64_t todo = tail - (d + 0);
+		int64_t skip = todo - (todo % P5);
+		for (int64_t i = d + skip, idx = idx0; i < tail; i += 125, idx += 125) {
 			idx -= N & -(idx >= N);
 			sum += 6 * V2[idx];
 		}
 		todo = tail - (d + 25);
-		skip = todo - (todo % 16250);
-		for (int i = d + 25 + skip, idx = idx0 + 25; i < tail; i += 125, idx += 125) {
+		skip = todo - (todo % P5);
+		for (int64_t i = d + 25 + skip, idx = idx0 + 25; i < tail; i += 125, idx += 125) {
 			idx -= N & -(idx >= N);
 			sum += 4 * V2[idx];
 		}
 		part2 = 10 * part2 + (sum % 10);
 	}
+	return part2;
+}
+
+// Eight digits of the message at `offset` in the signal repeated `repeat`
+// times, or -1 if the suffix after the offset is over budget.  Only that
+// suffix is ever stored.
+static int message(const std::vector<int_t> &V2, int64_t offset, int repeat) {
+	int64_t N = V2.size();
+	int64_t total = N * repeat;
+	if (offset >= total) return 0;
+
+	// The combinatorial shortcut needs the message in the second half
+	// and at least one full period of its coefficients per repetition
+	if (2 * offset >= total && N >= 128) {
+		return combinatorial(V2, offset, total);
+	}
+
+	if (total - offset > MAX_SUFFIX) return -1;
+
+	// Copy the suffix a run of the signal at a time
+	std::vector<int_t> D(total - offset);
+	for (int64_t i = 0, idx = offset % N; i < D.size(); idx = 0) {
+		int64_t n = std::min<int64_t>(N - idx, D.size() - i);
+		std::copy_n(&V2[idx], n, &D[i]);
+		i += n;
+	}
+	fft_phase phase(D.size(), offset);
+	for (int e = 0; e < PHASES; e++) {
+		phase(D);
+	}
+
+	int part2 = 0;
+	for (int i = 0; i < 8 && i < D.size(); i++) part2 = 10 * part2 + D[i];
+	return part2;
+}
+
+output_t day16(input_t in) {
+	std::vector<int_t> V1, V2;
+	V1.reserve(in.len);
+	V2.reserve(in.len);
+	for (; in.len--; in.s++) {
+		uint8_t c = *in.s - '0';
+		if (c < 10) {
+			V1.push_back(c);
+			V2.push_back(c);
+		}
+	}
+	int64_t N = V2.size();
+	if (N > MAX_DIGITS) return { "?", "?" };
+
+	// Part 1
+	fft_phase phase(N);
+	for (int e = 0; e < PHASES; e++) {
+		phase(V1);
+	}
+	int part1 = 0;
+	for (int i = 0; i < 8; i++) part1 = 10 * part1 + V1[i];
+
+	// Part 2, reported as unknown when it would need too much memory
+	int64_t offset = 0;
+	for (int i = 0; i < 7; i++) offset = 10 * offset + V2[i];
+	int part2 = message(V2, offset, P2_REPEAT);
+	if (part2 < 0) return { part1, "?" };
 
 	return { part1, part2 };
 }
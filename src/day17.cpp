@@ -2,9 +2,6 @@
 
 // Day 17: Set and Forget
 
-constexpr int LIMIT = 20;
-constexpr int MLIMIT = 10;
-
 namespace {
 
 struct pt {
@@ -13,56 +10,121 @@ struct pt {
 	pt(int x, int y) : x(x), y(y) { }
 };
 
-struct sol_t {
-	std::vector<int> M;
-	std::vector<int> P[3];
-	sol_t() : M(), P() { }
+// Robot memory constraints
+struct limits {
+	int funcs;  // number of movement functions
+	int length; // characters per movement function
+	int main;   // calls in the main routine
 };
 
-}
+/* Splits the path into a main routine and movement functions by
+ * backtracking search.  Functions are substrings of the path, which
+ * are compared in O(1) using prefix hashes.  Failed searches are
+ * remembered by position and function set, along with how many main
+ * routine calls had been used.
+ */
+struct compressor {
+	static constexpr uint64_t MOD = (1ULL << 61) - 1, BASE = 1000003;
+	static constexpr size_t MEMO_MIN = 32;
+
+	const std::vector<int8_t> &P;
+	limits L;
+
+	std::vector<uint64_t> H, Pow;       // prefix hashes
+	std::vector<int> Cost;              // prefix text lengths
+	std::vector<uint64_t> FK = { 0 };   // hashes of function set prefixes
+	std::unordered_map<uint64_t, int> failed;
+	size_t nodes = 0;
+
+	std::vector<int> M;                 // main routine
+	std::vector<std::pair<int, int>> F; // functions (start, length)
+
+	compressor(const std::vector<int8_t> &P, limits L) :
+		P(P), L(L), H(P.size() + 1), Pow(P.size() + 1, 1), Cost(P.size() + 1)
+	{
+		for (size_t i = 0; i < P.size(); i++) {
+			H[i + 1] = mod(mulmod(H[i], BASE) + uint8_t(P[i]) + 1);
+			Pow[i + 1] = mulmod(Pow[i], BASE);
+			// "L,12," is the turn, two commas, and the step count
+			int k = P[i] & 0x7f;
+			Cost[i + 1] = Cost[i] + 4 + (k > 9) + (k > 99);
+		}
+	}
+
+	bool operator() () {
+		return solve(0);
+	}
+
+    private:
+	static uint64_t mod(uint64_t n) {
+		return (n >= MOD) ? n - MOD : n;
+	}
+
+	static uint64_t mulmod(uint64_t a, uint64_t b) {
+		unsigned __int128 n = (unsigned __int128)a * b;
+		return mod((uint64_t(n) & MOD) + uint64_t(n >> 61));
+	}
 
-static bool solve(sol_t &S, const std::vector<int8_t> &P, int idx, int used) {
-	if (idx == P.size()) return true;
-	if (S.M.size() == MLIMIT) return false;
+	uint64_t hash(int start, int len) const {
+		return mod(H[start + len] + MOD - mulmod(H[start], Pow[len]));
+	}
 
-	// Recycle existing program
-	for (int i = 0; i < used; i++) {
-		auto &prog = S.P[i];
-		if (idx + prog.size() > P.size()) continue;
+	// Does function f appear at position idx?  (61-bit hashes,
+	// collisions are vanishingly unlikely)
+	bool matches(const std::pair<int, int> &f, int idx) const {
+		auto [ start, len ] = f;
+		return idx + len <= int(P.size()) && P[idx] == P[start] &&
+			hash(idx, len) == hash(start, len);
+	}
 
-		bool nope = false;
-		for (int j = 0; j < prog.size(); j++) {
-			if (P[idx + j] != prog[j]) {
-				nope = true;
-				break;
+	bool solve(int idx) {
+		if (idx == int(P.size())) return true;
+		if (int(M.size()) == L.main) return false;
+
+		uint64_t key = FK.back() ^ (idx * 0x9e3779b97f4a7c15ULL);
+		if (!failed.empty()) {
+			auto it = failed.find(key);
+			if (it != failed.end() && int(M.size()) >= it->second) return false;
+		}
+		size_t visited = nodes++;
+
+		// Recycle existing function
+		for (int i = 0; i < int(F.size()); i++) {
+			if (!matches(F[i], idx)) continue;
+			M.push_back(i);
+			if (solve(idx + F[i].second)) {
+				return true;
 			}
+			M.pop_back();
 		}
-		if (nope) continue;
 
-		S.M.push_back(i);
-		if (solve(S, P, idx + prog.size(), used)) {
-			return true;
+		// Write new function
+		if (int(F.size()) < L.funcs) {
+			M.push_back(F.size());
+			F.emplace_back(idx, 0);
+			FK.push_back(0);
+			for (int end = idx + 1; end <= int(P.size()); end++) {
+				if (Cost[end] - Cost[idx] - 1 > L.length) break;
+				F.back().second = end - idx;
+				FK.back() = mulmod(FK.end()[-2] + 1, BASE) ^ hash(idx, end - idx) ^ uint64_t(end - idx) << 56;
+				if (solve(end)) {
+					return true;
+				}
+			}
+			FK.pop_back();
+			F.pop_back();
+			M.pop_back();
 		}
-		S.M.pop_back();
-	}
 
-	if (used == 3) return false;
-
-	// Write new program
-	auto &prog = S.P[used];
-	S.M.push_back(used);
-	for (int cost = -1; idx < P.size(); idx++) {
-		cost += 4 + ((P[idx] & 0x7f) > 9);
-		if (cost > LIMIT) break;
-		prog.push_back(P[idx]);
-		if (solve(S, P, idx + 1, used + 1)) {
-			return true;
+		// Only remember failures which took some effort to find
+		if (nodes - visited >= MEMO_MIN) {
+			auto &m = failed.try_emplace(key, M.size()).first->second;
+			m = std::min(m, int(M.size()));
 		}
+		return false;
 	}
-	prog.clear();
-	S.M.pop_back();
+};
 
-	return false;
 }
 
 output_t day17(input_t in) {
@@ -124,8 +186,9 @@ output_t day17(input_t in) {
 	I.back() |= steps;
 
 	// Find a program that solves the maze
-	sol_t S;
-	if (!solve(S, I, 0, 0)) abort();
+	limits L{3, 20, 10};
+	compressor S{I, L};
+	if (!S()) abort();
 
 	// Convert the program to text
 	std::string s;
@@ -134,18 +197,14 @@ output_t day17(input_t in) {
 		s.push_back(S.M[i] + 'A');
 	}
 	s.push_back('\n');
-	for (int i = 0; i < 3; i++) {
-		for (int j = 0; j < S.P[i].size(); j++) {
-			if (j) s.push_back(',');
-			int k = S.P[i][j];
+	S.F.resize(L.funcs); // unused functions are left empty
+	for (auto [ start, len ] : S.F) {
+		for (int j = start; j < start + len; j++) {
+			if (j > start) s.push_back(',');
+			int k = I[j];
 			s.push_back((k & 0x80) ? 'L' : 'R');
-			k &= 0x7f;
 			s.push_back(',');
-			if (k > 9) {
-				s.push_back('1');
-				k -= 10;
-			}
-			s.push_back(k + '0');
+			s += std::to_string(k & 0x7f);
 		}
 		s.push_back('\n');
 	}
@@ -1,3 +1,7 @@
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <mutex>
 #include "advent2019.h"
 
 // Day 18: Many-Worlds Interpretation
@@ -6,12 +10,20 @@
  * as possible, then solve using heuristic best-first search.
  * Part 1 and Part 2 have different admissible tree reductions,
  * and are optimized separately.
+ *
+ * The key set type is the narrowest of 32, 64, 128 or 256 bits which
+ * fits the vault, and large vaults are searched in parallel.
+ *
+ * A single '@' with open cells all around it is the hub of the puzzle's
+ * four quadrants, and both parts are solved.  Any other vault is solved
+ * as given, with one robot per '@': as Part 1 if there is one robot,
+ * and as Part 2 if there are several.
  */
 
-using mask_t = uint32_t;
-
-constexpr int N_KEYS = 26;
 constexpr int HASH_SIZE = 15000;
+constexpr int PARALLEL_KEYS = 40; // search larger vaults with HDA*
+constexpr int MAX_KEYS = 256;
+constexpr int MAX_ROBOTS = 16;
 
 static void assert(bool predicate, const std::string &msg) {
 	if (predicate) return;
@@ -21,348 +33,644 @@ static void assert(bool predicate, const std::string &msg) {
 
 namespace {
 
-struct node;
-using tree4 = std::array<node *, 4>;
+using index_t = uint32_t;
+using grid_t = std::vector<std::u32string>;
+
+// Key sets wider than 128 bits, as an array of 64-bit words
+template<int W>
+struct wide_mask {
+	uint64_t w[W] = { };
 
-// Disjoint-set structure of keys
-struct keymap {
-	std::vector<int> M;
-	keymap() : M(N_KEYS) {
-		for (int i = 0; i < N_KEYS; i++) M[i] = i;
+	wide_mask(uint64_t v = 0) { w[0] = v; }
+
+	explicit operator bool () const {
+		uint64_t any = 0;
+		for (auto x : w) any |= x;
+		return any;
 	}
-	int find(int n) {
-		while (M[n] != n) n = M[n] = M[M[n]];
-		return n;
+
+	wide_mask operator ~ () const {
+		wide_mask r;
+		for (int i = 0; i < W; i++) r.w[i] = ~w[i];
+		return r;
 	}
-	int join(mask_t key) {
-		int r = find(*bits(key));
-		for (auto k : ++bits(key)) M[k] = r;
+
+	wide_mask operator << (int k) const {
+		wide_mask r;
+		int q = k / 64, s = k % 64;
+		for (int i = W - 1; i >= q; i--) {
+			r.w[i] = w[i - q] << s;
+			if (s && i > q) r.w[i] |= w[i - q - 1] >> (64 - s);
+		}
 		return r;
 	}
+
+	wide_mask & operator &= (const wide_mask &o) { for (int i = 0; i < W; i++) w[i] &= o.w[i]; return *this; }
+	wide_mask & operator |= (const wide_mask &o) { for (int i = 0; i < W; i++) w[i] |= o.w[i]; return *this; }
+	wide_mask & operator ^= (const wide_mask &o) { for (int i = 0; i < W; i++) w[i] ^= o.w[i]; return *this; }
+
+	wide_mask operator & (const wide_mask &o) const { auto r = *this; return r &= o; }
+	wide_mask operator | (const wide_mask &o) const { auto r = *this; return r |= o; }
+	wide_mask operator ^ (const wide_mask &o) const { auto r = *this; return r ^= o; }
+
+	bool operator == (const wide_mask &o) const { return !memcmp(w, o.w, sizeof(w)); }
+	bool operator != (const wide_mask &o) const { return !(*this == o); }
 };
 
-struct node {
-	std::vector<node *> C = {}; // children
-	int cost = 0, max_depth = 0;
-	mask_t key = 0, door = 0;
-	mask_t subkey = 0, subdoor = 0;
+// Bit operations for any key set width
+static int ctz(uint32_t m) { return __builtin_ctz(m); }
+static int ctz(uint64_t m) { return __builtin_ctzll(m); }
+static int ctz(unsigned __int128 m) {
+	return uint64_t(m) ? ctz(uint64_t(m)) : 64 + ctz(uint64_t(m >> 64));
+}
+template<int W>
+static int ctz(const wide_mask<W> &m) {
+	int i = 0;
+	while (!m.w[i]) i++;
+	return 64 * i + ctz(m.w[i]);
+}
 
-	~node() { for (auto n : C) delete n; }
+static int popcount(uint32_t m) { return __builtin_popcount(m); }
+static int popcount(uint64_t m) { return __builtin_popcountll(m); }
+static int popcount(unsigned __int128 m) {
+	return popcount(uint64_t(m)) + popcount(uint64_t(m >> 64));
+}
+template<int W>
+static int popcount(const wide_mask<W> &m) {
+	int n = 0;
+	for (auto x : m.w) n += popcount(x);
+	return n;
+}
 
-	node * clone() const {
-		node *N = new node(*this);
-		for (auto &n : N->C) n = n->clone();
-		return N;
+// Clear the lowest set bit
+template<typename mask_t>
+static mask_t without_lowest(mask_t m) { return m & (m - 1); }
+template<int W>
+static wide_mask<W> without_lowest(wide_mask<W> m) {
+	for (auto &x : m.w) {
+		if (x) { x &= x - 1; break; }
 	}
+	return m;
+}
+
+// Fold a key set into 64 bits for hashing
+static uint64_t fold(uint32_t m) { return m; }
+static uint64_t fold(uint64_t m) { return m; }
+static uint64_t fold(unsigned __int128 m) {
+	return uint64_t(m) ^ uint64_t(m >> 64) * 0xc2b2ae3d27d4eb4fULL;
+}
+template<int W>
+static uint64_t fold(const wide_mask<W> &m) {
+	uint64_t h = 0;
+	for (int i = W; i--; ) h = h * 0xc2b2ae3d27d4eb4fULL ^ m.w[i];
+	return h;
+}
 
-	void rebuild_recursive_stats() {
-		subkey = key;
-		subdoor = door;
-		max_depth = cost;
-		for (auto n : C) {
-			n->rebuild_recursive_stats();
-			subkey |= n->subkey;
-			subdoor |= n->subdoor;
-			max_depth = std::max(max_depth, cost + n->max_depth);
+// Like bits, for key sets of any width
+template<typename mask_t>
+struct key_bits {
+	mask_t mask;
+	key_bits(mask_t mask) : mask(mask)        { }
+	key_bits& operator++ ()                   { mask = without_lowest(mask); return *this; }
+	bool operator!= (const key_bits &o) const { return mask != o.mask; }
+	int operator* () const                    { return ctz(mask); }
+	key_bits begin() const                    { return mask; }
+	key_bits end() const                      { return mask_t(0); }
+};
+
+// Keys are 'a'-'z', then U+E000 onwards for larger vaults; doors are
+// 'A'-'Z', then U+F000 onwards
+static int key_id(char32_t c) {
+	if (c >= 'a' && c <= 'z') return c - 'a';
+	if (c >= 0xe000 && c < 0xf000) return c - 0xe000 + 26;
+	return -1;
+}
+
+static int door_id(char32_t c) {
+	if (c >= 'A' && c <= 'Z') return c - 'A';
+	if (c >= 0xf000 && c < 0xf900) return c - 0xf000 + 26;
+	return -1;
+}
+
+// Split the maze into rows of cells, which are UTF-8 encoded
+static grid_t read_grid(input_t in) {
+	grid_t G;
+	auto p = (const unsigned char *)in.s, end = p + in.len;
+	while (p < end) {
+		auto eol = p;
+		while (eol < end && *eol != '\r' && *eol != '\n') eol++;
+		if (eol == p) {
+			p++;
+			continue;
 		}
+
+		auto &row = G.emplace_back(eol - p, 0);
+		auto out = row.begin();
+		while (p < eol) {
+			char32_t c = *p++;
+			if (c >= 0x80) {
+				assert(c >= 0xc0 && c < 0xf8, "bad UTF-8");
+				int n = (c >= 0xe0) + (c >= 0xf0) + 1;
+				c &= 0x3f >> n;
+				for (int i = 0; i < n; i++, p++) {
+					assert(p < eol && (*p & 0xc0) == 0x80, "bad UTF-8");
+					c = c << 6 | (*p & 0x3f);
+				}
+			}
+			*out++ = c;
+		}
+		row.erase(out, row.end());
 	}
+	return G;
+}
+
+// Monotone priority queue: keys pushed are never smaller than the
+// last key popped, which holds because the heuristic is consistent
+template<typename T>
+struct radix_heap {
+	using entry = std::pair<uint32_t, T>;
+
+	std::vector<entry> B[33];
+	uint32_t last = 0;
+	size_t n = 0;
+
+	int bucket(uint32_t key) const {
+		return key == last ? 0 : 32 - __builtin_clz(key ^ last);
+	}
+
+	bool empty() const { return !n; }
 
-	// Collapse subtree down to a single node
-	int flatten(keymap &KM) {
-		int base_cost = 0;
-		for (auto n : C) {
-			base_cost += n->flatten(KM);
-			cost += n->cost;
-			key |= n->key;
-			door |= n->door;
-			delete n;
-		}
-		C.clear();
-		subkey = key = 1 << KM.join(key);
-		base_cost += (cost - max_depth) * 2;
-		cost = max_depth;
-		return base_cost;
+	void emplace(uint32_t key, T value) {
+		B[bucket(key)].emplace_back(key, value);
+		n++;
 	}
 
-	// Doors must be renumbered whenever keys might have been joined
-	mask_t renumber_doors(keymap &KM) {
-		mask_t tmp = door;
-		door = 0;
-		for (auto k : bits(tmp)) {
-			door |= 1 << KM.find(k);
+	entry pop() {
+		if (B[0].empty()) {
+			int i = 1;
+			while (B[i].empty()) i++;
+			last = std::min_element(B[i].begin(), B[i].end())->first;
+			for (auto &e : B[i]) B[bucket(e.first)].push_back(e);
+			B[i].clear();
 		}
-		subdoor = door;
-		for (auto n : C) subdoor |= n->renumber_doors(KM);
-		return subdoor;
+		auto e = B[0].back();
+		B[0].pop_back();
+		n--;
+		return e;
 	}
 };
 
-struct loader {
-	using grid_t = std::vector<std::string>;
-
-	// convert a maze quadrant into a tree structure
-	static void dfs(decltype(node::C) &C0, grid_t &G, int x, int y) {
-		auto &c = G[x][y];
-		if (c == '#') return;
-		mask_t key  = (c >= 'a' && c <= 'z') ? 1 << (c - 'a') : 0;
-		mask_t door = (c >= 'A' && c <= 'Z') ? 1 << (c - 'A') : 0;
-		c = '#'; // prevent backtracking
-
-		decltype(node::C) C;
-		dfs(C, G, x-1, y);
-		dfs(C, G, x+1, y);
-		dfs(C, G, x, y-1);
-		dfs(C, G, x, y+1);
-
-		node *N;
-		if (key || C.size() > 1) { // key or intersection
-			(N = new node)->C = C;
-		} else if (C.empty()) { // dead end
-			return;
-		} else { // corridor
-			N = C[0];
-		}
-
-		N->cost++;
-		N->key |= key;
-		N->door |= door;
-
-		C0.push_back(N);
-	}
+// The solver, for key sets of type mask_t and up to ROBOTS robots
+template<typename mask_t, int ROBOTS>
+struct vault {
+	static constexpr int N_KEYS = sizeof(mask_t) * 8;
 
-	static node * dfs(grid_t &G, int x, int y) {
-		decltype(node::C) C;
-		dfs(C, G, x, y);
-		if (C.empty()) return new node;
-		C[0]->cost--;
-		C[0]->rebuild_recursive_stats();
-		return C[0];
-	}
+	// Key number of each robot's position, or N_KEYS at its start
+	using pos_t = std::conditional_t<(N_KEYS < 256), uint8_t, uint16_t>;
+
+	static mask_t bit(int k) { return mask_t(1) << k; }
 
-	static tree4 load(input_t in) {
-		grid_t G;
+	// Disjoint-set structure of keys
+	struct keymap {
+		std::vector<int> M;
+		keymap() : M(N_KEYS) {
+			for (int i = 0; i < N_KEYS; i++) M[i] = i;
+		}
+		int find(int n) {
+			while (M[n] != n) n = M[n] = M[M[n]];
+			return n;
+		}
+		int join(mask_t key) {
+			int r = find(*key_bits(key));
+			for (auto k : key_bits(without_lowest(key))) M[k] = r;
+			return r;
+		}
+	};
 
-		for (auto end = in.s + in.len; in.s < end; ) {
-			char *eol = in.s + strcspn(in.s, "\r\n");
-			G.emplace_back(in.s, eol - in.s);
-			in.s = eol + strspn(eol, "\r\n");
+	/* One tree per robot, stored in a single arena as a structure of
+	 * arrays.  Nodes are never created after loading, so removing a node
+	 * only unlinks it from its parent, and copying the forest is a flat
+	 * copy of each array.  The children of node n occupy
+	 * Child[First[n]..First[n]+Count[n]); a node's child list only shrinks.
+	 */
+	struct forest {
+		std::vector<int> cost, max_depth;
+		std::vector<mask_t> key, door, subkey, subdoor;
+		std::vector<index_t> First, Count, Child;
+
+		// Roots, one per robot.  At a hub, these are the four quadrants
+		// in clockwise order; two quadrants i, j are diagonally opposite
+		// iff (i ^ j == 2)
+		std::vector<index_t> R;
+		bool hub = false;
+
+		index_t add(const std::vector<index_t> &C = {}) {
+			index_t n = cost.size();
+			cost.push_back(0);
+			max_depth.push_back(0);
+			key.push_back(0);
+			door.push_back(0);
+			subkey.push_back(0);
+			subdoor.push_back(0);
+			First.push_back(Child.size());
+			Count.push_back(C.size());
+			Child.insert(Child.end(), C.begin(), C.end());
+			return n;
 		}
 
-		// Expected coordinate of '@' in center of maze
-		int at = G.size() / 2;
+		span<index_t> children(index_t N) {
+			auto p = &Child[First[N]];
+			return { p, p + Count[N] };
+		}
 
-		// Validate & fixup maze to ensure memory safety
-		assert(G.size() >= 5, "maze too small");
-		assert(G.size() % 4 == 1, "bad maze dimension");
-		for (auto &s : G) {
-			assert(s.size() == G.size(), "maze not square");
-			s.front() = s.back() = '#';
+		span<const index_t> children(index_t N) const {
+			auto p = &Child[First[N]];
+			return { p, p + Count[N] };
 		}
-		assert(G[at][at] == '@', "'@' not in center of maze");
 
-		// Split the maze into (acyclic for all inputs) quadrants
-		G[at-1][at] = G[at+1][at] = G[at][at-1] = G[at][at+1] = '#';
+		// Shrink N's child list to end at `it`
+		void truncate(index_t N, const index_t *it) {
+			Count[N] = it - &Child[First[N]];
+		}
 
-		// Return quadrants in clockwise order; two quadrants
-		// i, j are diagonally opposite iff (i ^ j == 2)
-		return {
-			dfs(G, at-1, at-1),
-			dfs(G, at+1, at-1),
-			dfs(G, at+1, at+1),
-			dfs(G, at-1, at+1) };
-	}
-};
+		void rebuild_recursive_stats(index_t N) {
+			subkey[N] = key[N];
+			subdoor[N] = door[N];
+			max_depth[N] = cost[N];
+			for (auto n : children(N)) {
+				rebuild_recursive_stats(n);
+				subkey[N] |= subkey[n];
+				subdoor[N] |= subdoor[n];
+				max_depth[N] = std::max(max_depth[N], cost[N] + max_depth[n]);
+			}
+		}
 
-// keys collected so far, four robot positions
-struct state {
-	mask_t key = 0;
-	uint8_t pos[4] = { N_KEYS, N_KEYS, N_KEYS, N_KEYS };
+		// Collapse subtree down to a single node
+		int flatten(index_t N, keymap &KM) {
+			int base_cost = 0;
+			for (auto n : children(N)) {
+				base_cost += flatten(n, KM);
+				cost[N] += cost[n];
+				key[N] |= key[n];
+				door[N] |= door[n];
+			}
+			Count[N] = 0;
+			subkey[N] = key[N] = bit(KM.join(key[N]));
+			base_cost += (cost[N] - max_depth[N]) * 2;
+			cost[N] = max_depth[N];
+			return base_cost;
+		}
 
-	operator uint64_t () const { return *(const uint64_t *)(this); }
-	state(mask_t key) : key(key) { }
-	struct hash {
-		std::size_t operator() (const state &S) const {
-			return std::hash<uint64_t>{}(S);
+		// Doors must be renumbered whenever keys might have been joined
+		mask_t renumber_doors(index_t N, keymap &KM) {
+			mask_t tmp = door[N];
+			door[N] = 0;
+			for (auto k : key_bits(tmp)) {
+				door[N] |= bit(KM.find(k));
+			}
+			subdoor[N] = door[N];
+			for (auto n : children(N)) subdoor[N] |= renumber_doors(n, KM);
+			return subdoor[N];
 		}
 	};
-};
 
-// cost, forbidden moves
-struct metric {
-	int cost = 0;
-	mask_t exclude = 0;
+	struct loader {
+		// convert a maze region into a tree structure
+		static void dfs(forest &F, std::vector<index_t> &C0, grid_t &G, int x, int y) {
+			auto &c = G[x][y];
+			if (c == '#') return;
+			int k = key_id(c), d = door_id(c);
+			mask_t key  = (k >= 0) ? bit(k) : 0;
+			mask_t door = (d >= 0) ? bit(d) : 0;
+			c = '#'; // prevent backtracking
+
+			std::vector<index_t> C;
+			dfs(F, C, G, x-1, y);
+			dfs(F, C, G, x+1, y);
+			dfs(F, C, G, x, y-1);
+			dfs(F, C, G, x, y+1);
+
+			index_t N;
+			if (key || C.size() > 1) { // key or intersection
+				N = F.add(C);
+			} else if (C.empty()) { // dead end
+				return;
+			} else { // corridor
+				N = C[0];
+			}
 
-	metric() { }
-	metric(int cost, mask_t exclude = 0) :
-		cost(cost), exclude(exclude)
-	{
-	}
-};
+			F.cost[N]++;
+			F.key[N] |= key;
+			F.door[N] |= door;
 
-using state_map_t = std::unordered_map<state, metric, state::hash>;
+			C0.push_back(N);
+		}
 
-// priority queue entry
-struct qentry {
-	state_map_t::iterator state;
-	int heuristic;
-	qentry(decltype(state) state, int heuristic) : state(state), heuristic(heuristic) { }
-	bool operator < (const qentry &o) const {
-		return heuristic > o.heuristic;
-	}
-};
+		static index_t dfs(forest &F, grid_t &G, int x, int y) {
+			std::vector<index_t> C;
+			dfs(F, C, G, x, y);
+			if (C.empty()) return F.add();
+			F.cost[C[0]]--;
+			F.rebuild_recursive_stats(C[0]);
+			return C[0];
+		}
 
-struct solver_base {
-	tree4 R;
+		static index_t root(forest &F, grid_t &G, int x, int y) {
+			assert(G[x][y] != '#', "robots share a region");
+			return dfs(F, G, x, y);
+		}
 
-	// Distance between keys (index N_KEYS is the start position)
-	int Dist[N_KEYS + 1][N_KEYS + 1] = { };
+		static forest load(grid_t G) {
+			// Validate & fixup maze to ensure memory safety
+			assert(G.size() >= 3 && G[0].size() >= 3, "maze too small");
+			for (auto &s : G) {
+				assert(s.size() == G[0].size(), "maze not rectangular");
+				s.front() = s.back() = '#';
+			}
+			std::fill(G.front().begin(), G.front().end(), '#');
+			std::fill(G.back().begin(), G.back().end(), '#');
 
-	// Which doors are in front of a key
-	mask_t Door[N_KEYS] = { };
+			std::vector<std::pair<int, int>> at;
+			for (int x = 0; x < G.size(); x++) {
+				for (int y = 0; y < G[x].size(); y++) {
+					if (G[x][y] == '@') at.emplace_back(x, y);
+				}
+			}
+			assert(!at.empty(), "no '@' in maze");
+
+			bool hub = at.size() == 1;
+			for (int dx = -1; hub && dx <= 1; dx++) {
+				for (int dy = -1; dy <= 1; dy++) {
+					hub &= G[at[0].first + dx][at[0].second + dy] != '#';
+				}
+			}
 
-	// Heuristic minimum cost to collect each key
-	int MinDist[N_KEYS] = { };
+			forest F;
+			if (hub) {
+				// Split the maze into (acyclic for all inputs) quadrants
+				auto [x, y] = at[0];
+				G[x-1][y] = G[x+1][y] = G[x][y-1] = G[x][y+1] = '#';
+				F.hub = true;
+				F.R = {
+					root(F, G, x-1, y-1),
+					root(F, G, x+1, y-1),
+					root(F, G, x+1, y+1),
+					root(F, G, x-1, y+1) };
+			} else {
+				// Each robot's region must be acyclic
+				for (auto [x, y] : at) F.R.push_back(root(F, G, x, y));
+			}
+			assert(F.R.size() <= ROBOTS, "too many robots");
+			return F;
+		}
+	};
 
-	// Goal state
-	mask_t goal = 0;
+	// keys collected so far, robot positions
+	struct state {
+		mask_t key = 0;
+		pos_t pos[ROBOTS];
 
-	solver_base(const decltype(R) &R) : R(R) {
-		for (auto n : R) {
-			door_index(n);
-			pairwise_distance(n);
-			goal |= n->subkey;
+		state(mask_t key) : key(key) {
+			std::fill_n(pos, ROBOTS, N_KEYS);
 		}
-	}
 
-	// Populate Door[] array, indexed by key number
-	void door_index(node *N, mask_t door = 0) {
-		door |= N->door;
-		if (N->key) Door[*bits(N->key)] = door;
-		door |= N->key; // ensure parent key is collected first
-		for (auto n : N->C) door_index(n, door);
-	}
+		bool operator == (const state &o) const {
+			return key == o.key && !memcmp(pos, o.pos, sizeof(pos));
+		}
 
-	// Tabulate pairwise distances between keys in separate subtrees of N
-	void pairwise_distance(node *N, int cost = 0) {
-		cost += N->cost;
-		for (auto n : N->C) {
-			pairwise_distance(n, cost);
+		uint64_t hash() const {
+			uint64_t h = fold(key);
+			for (size_t i = 0; i < sizeof(pos); i += 8) {
+				uint64_t p = 0;
+				memcpy(&p, (const char *)pos + i, std::min<size_t>(sizeof(pos) - i, 8));
+				h = (h ^ (p << 32 | p >> 32)) * 0x9e3779b97f4a7c15ULL;
+			}
+			return h ^ (h >> 32);
 		}
+	};
 
-		// Distance from this quadrant's starting position
-		if (N->key) Dist[N_KEYS][*bits(N->key)] = cost;
+	// cost, forbidden moves
+	struct metric {
+		int cost = 0;
+		mask_t exclude = 0;
 
-		int common = cost * 2;
-		for (auto n : N->C) {
-			for (auto k0 : bits(n->subkey)) {
-				for (auto k1 : bits(N->subkey ^ n->subkey)) {
-					Dist[k0][k1] = Dist[k1][k0] = Dist[N_KEYS][k0] + Dist[N_KEYS][k1] - common;
-				}
+		metric() { }
+		metric(int cost, mask_t exclude = 0) :
+			cost(cost), exclude(exclude)
+		{
+		}
+	};
+
+	// Open-addressing map from state to metric.  Entries live in a dense
+	// array and are referred to by index.  The slot table doubles when half
+	// full, and the old table is migrated a few slots per insert, so no
+	// single insert pays for a full rehash.
+	struct state_map {
+		static constexpr uint32_t EMPTY = -1;
+		static constexpr int MIGRATE = 4;
+
+		struct slot {
+			uint64_t hash;
+			uint32_t idx;
+		};
+
+		std::vector<std::pair<state, metric>> E;
+		std::vector<slot> T, Old;
+		size_t moved = 0;
+
+		state_map(size_t n) {
+			size_t cap = 16;
+			while (cap < n * 2) cap *= 2;
+			T.assign(cap, { 0, EMPTY });
+			E.reserve(n);
+		}
+
+		std::pair<state, metric> & operator[] (uint32_t i) { return E[i]; }
+
+		// Find S or the empty slot where it belongs
+		slot & probe(std::vector<slot> &T, const state &S, uint64_t h) {
+			size_t mask = T.size() - 1;
+			for (size_t i = h; ; i++) {
+				auto &t = T[i & mask];
+				if (t.idx == EMPTY) return t;
+				if (t.hash == h && E[t.idx].first == S) return t;
 			}
 		}
-	}
 
-	// Find distances between keys across quadrants
-	void cross_link(mask_t key0, mask_t key1, int dist) {
-		for (auto k0 : bits(key0)) {
-			for (auto k1 : bits(key1)) {
-				Dist[k0][k1] = Dist[k1][k0] = Dist[N_KEYS][k0] + Dist[N_KEYS][k1] + dist;
+		// Returns {index, inserted}, like unordered_map::emplace
+		std::pair<uint32_t, bool> emplace(const state &S, const metric &M) {
+			uint64_t h = S.hash();
+			if (!Old.empty()) migrate();
+
+			auto &t = probe(T, S, h);
+			if (t.idx != EMPTY) return { t.idx, false };
+			if (!Old.empty()) {
+				// Entries that were already migrated are found in T first
+				auto &o = probe(Old, S, h);
+				if (o.idx != EMPTY) return { o.idx, false };
 			}
+
+			t = { h, uint32_t(E.size()) };
+			E.emplace_back(S, M);
+			if (E.size() * 2 > T.size()) grow();
+			return { E.size() - 1, true };
 		}
-	}
 
-	void cross_link() {
-		// Adjacent quadrants
-		cross_link(R[0]->subkey, R[1]->subkey, 2);
-		cross_link(R[1]->subkey, R[2]->subkey, 2);
-		cross_link(R[2]->subkey, R[3]->subkey, 2);
-		cross_link(R[3]->subkey, R[0]->subkey, 2);
+	    private:
+		void grow() {
+			while (!Old.empty()) migrate();
+			Old = std::move(T);
+			T.assign(Old.size() * 2, { 0, EMPTY });
+			moved = 0;
+		}
 
-		// Diagonal quadrants
-		cross_link(R[0]->subkey, R[2]->subkey, 4);
-		cross_link(R[1]->subkey, R[3]->subkey, 4);
-	}
+		void migrate() {
+			for (int n = 0; n < MIGRATE && moved < Old.size(); n++) {
+				auto &o = Old[moved++];
+				if (o.idx == EMPTY) continue;
+				size_t mask = T.size() - 1, i = o.hash;
+				while (T[i & mask].idx != EMPTY) i++;
+				T[i & mask] = o;
+			}
+			if (moved == Old.size()) Old = {};
+		}
+	};
+
+	template<int PART>
+	struct solver {
+		const forest &F;
+
+		// Distance between keys (index N_KEYS is the start position)
+		int Dist[N_KEYS + 1][N_KEYS + 1] = { };
 
-	void compute_heuristic(mask_t key) {
-		for (auto k1 : bits(key)) {
-			// Distance from start position in quadrant
-			MinDist[k1] = Dist[N_KEYS][k1];
+		// Which doors are in front of a key
+		mask_t Door[N_KEYS] = { };
 
-			for (auto k0 : bits(key ^ (1 << k1))) {
-				// Ignore moves contrary to known precedence
-				if (Door[k0] & (1 << k1)) continue;
-				MinDist[k1] = std::min(MinDist[k1], Dist[k0][k1]);
+		// Heuristic minimum cost to collect each key
+		int MinDist[N_KEYS] = { };
+
+		// Goal state
+		mask_t goal = 0;
+
+		solver(const forest &F) : F(F) {
+			for (auto n : F.R) {
+				door_index(n);
+				pairwise_distance(n);
+				goal |= F.subkey[n];
+			}
+
+			if (PART == 1) {
+				// Robot can travel between quadrants
+				if (F.hub) cross_link();
+				compute_heuristic(goal);
+			} else {
+				// Robots stay within a single quadrant
+				for (auto n : F.R) {
+					compute_heuristic(F.subkey[n]);
+				}
 			}
 		}
-	}
-};
 
-template<int PART>
-struct solver : solver_base {
-	solver(const decltype(R) &R) : solver_base(R) {
-		if (PART == 1) {
-			// Robot can travel between quadrants
-			cross_link();
-			compute_heuristic(goal);
-		} else {
-			// Robots stay within a single quadrant
-			for (auto n : R) {
-				compute_heuristic(n->subkey);
+		// Populate Door[] array, indexed by key number
+		void door_index(index_t N, mask_t door = 0) {
+			door |= F.door[N];
+			if (F.key[N]) Door[*key_bits(F.key[N])] = door;
+			door |= F.key[N]; // ensure parent key is collected first
+			for (auto n : F.children(N)) door_index(n, door);
+		}
+
+		// Tabulate pairwise distances between keys in separate subtrees of N
+		void pairwise_distance(index_t N, int cost = 0) {
+			cost += F.cost[N];
+			for (auto n : F.children(N)) {
+				pairwise_distance(n, cost);
+			}
+
+			// Distance from this quadrant's starting position
+			if (F.key[N]) Dist[N_KEYS][*key_bits(F.key[N])] = cost;
+
+			int common = cost * 2;
+			for (auto n : F.children(N)) {
+				for (auto k0 : key_bits(F.subkey[n])) {
+					for (auto k1 : key_bits(F.subkey[N] ^ F.subkey[n])) {
+						Dist[k0][k1] = Dist[k1][k0] = Dist[N_KEYS][k0] + Dist[N_KEYS][k1] - common;
+					}
+				}
 			}
 		}
-	}
 
-	int operator() () {
-		const int r_max = (PART == 1) ? 1 : R.size();
+		// Find distances between keys across quadrants
+		void cross_link(mask_t key0, mask_t key1, int dist) {
+			for (auto k0 : key_bits(key0)) {
+				for (auto k1 : key_bits(key1)) {
+					Dist[k0][k1] = Dist[k1][k0] = Dist[N_KEYS][k0] + Dist[N_KEYS][k1] + dist;
+				}
+			}
+		}
 
-		std::unordered_map<state, metric, state::hash> Frontier(HASH_SIZE);
-		std::priority_queue<qentry> Q;
+		void cross_link() {
+			mask_t sk[4];
+			for (int i = 0; i < 4; i++) sk[i] = F.subkey[F.R[i]];
 
-		Frontier.emplace(goal, metric{});
-		Q.emplace(Frontier.begin(), 0);
-		while (!Q.empty()) {
-			auto q = Q.top();
-			Q.pop();
+			// Adjacent quadrants
+			cross_link(sk[0], sk[1], 2);
+			cross_link(sk[1], sk[2], 2);
+			cross_link(sk[2], sk[3], 2);
+			cross_link(sk[3], sk[0], 2);
 
-			auto& [ S0, M0 ] = *q.state;
+			// Diagonal quadrants
+			cross_link(sk[0], sk[2], 4);
+			cross_link(sk[1], sk[3], 4);
+		}
 
-			int cost = std::exchange(M0.cost, -1);
-			mask_t exclude = M0.exclude;
+		void compute_heuristic(mask_t key) {
+			for (auto k1 : key_bits(key)) {
+				// Distance from start position in quadrant
+				MinDist[k1] = Dist[N_KEYS][k1];
 
-			if (!S0.key) {
-				// solved
-				return cost;
-			} else if (cost == -1) {
-				// already visited
-				continue;
+				for (auto k0 : key_bits(key ^ bit(k1))) {
+					// Ignore moves contrary to known precedence
+					if (Door[k0] & bit(k1)) continue;
+					MinDist[k1] = std::min(MinDist[k1], Dist[k0][k1]);
+				}
 			}
+		}
+
+
+		// Priority is cost so far plus the heuristic cost to
+		// collect the remaining keys
+		uint32_t initial_priority() const {
+			uint32_t h = 0;
+			for (auto k : key_bits(goal)) h += MinDist[k];
+			return h;
+		}
+
+		// Generate the moves out of S0, calling emit(state, metric, priority)
+		template<typename Emit>
+		void expand(const state &S0, int cost, mask_t exclude, uint32_t heuristic, Emit emit) const {
+			const int r_max = (PART == 1) ? 1 : F.R.size();
 
 			for (int r = 0; r < r_max; r++) {
-				auto n = R[r];
+				auto n = F.R[r];
 
-				mask_t todo = S0.key & (n->subkey | -(PART == 1));
+				mask_t todo = S0.key & ((PART == 1) ? ~mask_t(0) : F.subkey[n]);
 
-				for (auto k : bits(todo & ~exclude)) {
+				for (auto k : key_bits(todo & ~exclude)) {
 					if (Door[k] & S0.key) continue;
 
 					auto c = cost + Dist[S0.pos[r]][k];
 
 					// If we skip all available moves, don't try again
 					// until this robot has moved elsewhere first
-					if (PART == 2) exclude |= 1 << k;
+					if (PART == 2) exclude |= bit(k);
 
 					state S = S0;
-					S.key ^= 1 << k;
+					S.key ^= bit(k);
 					S.pos[r] = k;
 
-					metric M{c, exclude & ~n->subkey};
+					metric M{c, exclude & ~F.subkey[n]};
 
-					auto [ it, ok ] = Frontier.emplace(S, M);
-					if (!ok) {
-						if (c >= it->second.cost) continue;
-						it->second = M;
-					}
-					Q.emplace(it, (q.heuristic - MinDist[k]) + (c - cost));
+					emit(S, M, (heuristic - MinDist[k]) + (c - cost));
 				}
 
 				// Skipped all moves, but no keys left to uncover
@@ -372,239 +680,434 @@ struct solver : solver_base {
 			}
 		}
 
-		return -1;
-	}
-};
+		void report(size_t expanded, std::chrono::steady_clock::time_point t0, int T) const {
+			double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			stat("Part %d: %zu states expanded, %.0f states/s, %d threads", PART, expanded, expanded / elapsed, T);
+		}
 
-struct optimizer {
-	tree4 R;
-	mask_t all_doors = 0;
+		int operator() () {
+			// The search space grows quickly with the number of keys;
+			// only large vaults are worth spreading across threads
+			int n_keys = popcount(goal);
+			int T = (n_keys > PARALLEL_KEYS) ? worker_count(n_keys, 1) : 1;
+			return (T > 1) ? parallel_search(T) : search();
+		}
 
-	optimizer(tree4 R) : R(R) { }
+		int search() {
+			state_map Frontier(HASH_SIZE);
+			radix_heap<uint32_t> Q;
 
-	optimizer clone() const {
-		optimizer O = *this;
-		for (auto &n : O.R) n = n->clone();
-		return O;
-	}
+			size_t expanded = 0;
+			auto t0 = std::chrono::steady_clock::now();
 
-	~optimizer() {
-		for (auto n : R) delete(n);
-	}
+			Frontier.emplace(goal, metric{});
+			Q.emplace(initial_priority(), 0);
+			while (!Q.empty()) {
+				auto [ heuristic, i ] = Q.pop();
 
-	// Optimizations valid for both parts
-	int common() {
-		int cost = 0;
-		all_doors = 0;
-		for (auto n : R) {
-			remove_free_doors(n);
-			all_doors |= n->subdoor;
-		}
-		for (auto n : R) {
-			remove_unused_keys(n, all_doors);
-			cost += merge_free_leaves(n, all_doors);
+				// Copy the state, the map may grow below
+				auto& M0 = Frontier[i].second;
+				state S0 = Frontier[i].first;
+
+				int cost = std::exchange(M0.cost, -1);
+
+				if (!S0.key) {
+					// solved
+					report(expanded, t0, 1);
+					return cost;
+				} else if (cost == -1) {
+					// already visited
+					continue;
+				}
+				expanded++;
+
+				expand(S0, cost, M0.exclude, heuristic, [&](const state &S, const metric &M, uint32_t priority) {
+					auto [ j, ok ] = Frontier.emplace(S, M);
+					if (!ok) {
+						if (M.cost >= Frontier[j].second.cost) return;
+						Frontier[j].second = M;
+					}
+					Q.emplace(priority, j);
+				});
+			}
+
+			report(expanded, t0, 1);
+			return -1;
 		}
-		renumber_doors();
 
-		return cost;
-	}
+		/* Hash-distributed A* (HDA*): each thread owns the states which
+		 * hash to it and runs its own best-first search, sending
+		 * generated states to their owner's inbox.  Arrival order is no
+		 * longer monotone, so closed states may be reopened, and the
+		 * search runs until no thread can improve on the best solution.
+		 */
+		int parallel_search(int T) {
+			struct message {
+				state S;
+				metric M;
+				uint32_t priority;
+			};
+
+			struct inbox {
+				std::mutex lock;
+				std::vector<message> M;
+			};
+
+			std::vector<inbox> In(T);
+			std::atomic<int> best{INT_MAX};
+			std::atomic<size_t> expanded{0};
+
+			// Messages in flight plus busy threads; done when zero
+			std::atomic<int64_t> work{T + 1};
+
+			auto owner = [T](const state &S) { return (S.hash() >> 40) % T; };
+
+			auto t0 = std::chrono::steady_clock::now();
+
+			In[owner(goal)].M.push_back({ goal, metric{}, initial_priority() });
+
+			parallel_for(T, T, [&](int t, size_t, size_t) {
+				using qentry = std::pair<uint32_t, uint32_t>;
+				std::priority_queue<qentry, std::vector<qentry>, std::greater<qentry>> Q;
+				state_map Frontier(HASH_SIZE);
+				std::vector<bool> closed;
+				std::vector<std::vector<message>> Out(T);
+				std::vector<message> received;
+				size_t n_expanded = 0;
+				bool busy = true;
+
+				auto add = [&](const state &S, const metric &M, uint32_t priority) {
+					auto [ j, ok ] = Frontier.emplace(S, M);
+					if (ok) {
+						closed.push_back(false);
+					} else {
+						if (M.cost >= Frontier[j].second.cost) return;
+						Frontier[j].second = M;
+						closed[j] = false;
+					}
+					Q.emplace(priority, j);
+				};
 
-	// Optimizations valid for Part 1 only: if a key is required to
-	// unlock a door, it cannot be the final key collected
-	int part1_only() {
-		int cost = 0;
-		for (auto n : R) cost += merge_free_door_keys(n, all_doors);
-		renumber_doors();
-		for (auto n : R) cost += flatten_free_branches(n);
-		renumber_doors();
-		return cost;
-	}
+				for (;;) {
+					{
+						std::lock_guard<std::mutex> guard(In[t].lock);
+						received.swap(In[t].M);
+					}
+					if (!received.empty()) {
+						if (!busy) work++, busy = true;
+						for (auto &m : received) add(m.S, m.M, m.priority);
+						work -= received.size();
+						received.clear();
+					}
 
-	// Optimizations valid for Part 2 only: robots do not
-	// backtrack out of their quadrant
-	int part2_only() {
-		int cost = 0;
-		for (auto n : R) cost += merge_free_branches(n);
-		renumber_doors();
-		return cost;
-	}
+					// Nothing left here which could beat the best solution
+					if (Q.empty() || int(Q.top().first) >= best) {
+						if (busy) work--, busy = false;
+						if (!work) break;
+						std::this_thread::yield();
+						continue;
+					}
 
-    private:
-	keymap KM;
-
-	// Common: If a door is a child of its own key, both can be ignored
-	mask_t remove_free_doors(node *N, mask_t key = 0) {
-		mask_t removed = N->door & key;
-		for (auto n : N->C) removed |= remove_free_doors(n, key | N->key);
-		N->key &= ~removed;
-		N->subkey &= ~removed;
-		N->door &= ~removed;
-		N->subdoor &= ~removed;
-		return removed;
-	}
+					auto [ heuristic, i ] = Q.top();
+					Q.pop();
+					if (closed[i]) continue;
+					closed[i] = true;
+
+					auto [ S0, M0 ] = Frontier[i];
+					if (!S0.key) {
+						// solved, but a cheaper solution may still exist
+						int b = best;
+						while (M0.cost < b && !best.compare_exchange_weak(b, M0.cost)) { }
+						continue;
+					}
+					n_expanded++;
+
+					expand(S0, M0.cost, M0.exclude, heuristic, [&](const state &S, const metric &M, uint32_t priority) {
+						int o = owner(S);
+						if (o == t) {
+							add(S, M, priority);
+						} else {
+							Out[o].push_back({ S, M, priority });
+						}
+					});
+
+					for (int o = 0; o < T; o++) {
+						if (Out[o].empty()) continue;
+						work += Out[o].size();
+						std::lock_guard<std::mutex> guard(In[o].lock);
+						In[o].M.insert(In[o].M.end(), Out[o].begin(), Out[o].end());
+						Out[o].clear();
+					}
+				}
+
+				expanded += n_expanded;
+			});
 
-	// Common: Keys in internal nodes can be ignored if the door
-	// does not need to be traversed
-	void remove_unused_keys(node *N, mask_t all_doors) {
-		if (N->C.empty()) return;
-		N->key &= all_doors;
-		N->subkey = N->key;
-		for (auto n : N->C) {
-			remove_unused_keys(n, all_doors);
-			N->subkey |= n->subkey;
+			report(expanded, t0, T);
+			return (best == INT_MAX) ? -1 : int(best);
 		}
-	}
+	};
 
-	// Common: Children may be merged if they meet the following:
-	//     - no doors
-	//     - the keys don't open any doors
-	int merge_free_leaves(node *N, mask_t all_doors) {
-		int cost = 0;
+	struct optimizer {
+		forest F;
+		mask_t all_doors = 0;
+
+		optimizer(forest F) : F(std::move(F)) { }
+
+		// Optimizations valid for both parts
+		int common() {
+			int cost = 0;
+			all_doors = 0;
+			for (auto n : F.R) {
+				remove_free_doors(n);
+				all_doors |= F.subdoor[n];
+			}
+			for (auto n : F.R) {
+				remove_unused_keys(n, all_doors);
+				cost += merge_free_leaves(n, all_doors);
+			}
+			renumber_doors();
 
-		for (auto n : N->C) {
-			cost += merge_free_leaves(n, all_doors);
+			return cost;
 		}
 
-		auto it = N->C.begin();
-		node *t = NULL;
+		// Optimizations valid for Part 1 only: if a key is required to
+		// unlock a door, it cannot be the final key collected
+		int part1_only() {
+			int cost = 0;
+			for (auto n : F.R) cost += merge_free_door_keys(n, all_doors);
+			renumber_doors();
+			for (auto n : F.R) cost += flatten_free_branches(n);
+			renumber_doors();
+			return cost;
+		}
 
-		for (auto n : N->C) {
-			if ((n->subkey & all_doors) || n->subdoor) {
-				*it++ = n;
-			} else if (!t) {
-				t = n;
-			} else {
-				t->key |= n->key;
-				t->max_depth = std::max(t->max_depth, n->max_depth);
-				t->cost += n->cost;
-				delete n;
-			}
+		// Optimizations valid for Part 2 only: robots do not
+		// backtrack out of their quadrant
+		int part2_only() {
+			int cost = 0;
+			for (auto n : F.R) cost += merge_free_branches(n);
+			renumber_doors();
+			return cost;
 		}
 
-		if (t) {
-			cost += (t->cost - t->max_depth) * 2;
-			t->cost = t->max_depth;
-			if (t->key) t->key = 1 << KM.join(t->key);
-			*it++ = t;
+	    private:
+		keymap KM;
+
+		void rebuild_subkey(index_t N) {
+			F.subkey[N] = F.key[N];
+			for (auto n : F.children(N)) F.subkey[N] |= F.subkey[n];
 		}
 
-		N->C.erase(it, N->C.end());
+		// Common: If a door is a child of its own key, both can be ignored
+		mask_t remove_free_doors(index_t N, mask_t key = 0) {
+			mask_t removed = F.door[N] & key;
+			for (auto n : F.children(N)) removed |= remove_free_doors(n, key | F.key[N]);
+			F.key[N] &= ~removed;
+			F.subkey[N] &= ~removed;
+			F.door[N] &= ~removed;
+			F.subdoor[N] &= ~removed;
+			return removed;
+		}
 
-		// Merge upward (a door is allowed on this node)
-		if (N->C.size() == 1 && !(N->subkey & all_doors)) {
-			auto n = N->C[0];
-			if (!n->subdoor) {
-				N->C.pop_back();
-				if (n->key) N->key = 1 << KM.join(N->key | n->key);
-				N->cost += n->cost;
-				delete n;
+		// Common: Keys in internal nodes can be ignored if the door
+		// does not need to be traversed
+		void remove_unused_keys(index_t N, mask_t all_doors) {
+			if (!F.Count[N]) return;
+			F.key[N] &= all_doors;
+			F.subkey[N] = F.key[N];
+			for (auto n : F.children(N)) {
+				remove_unused_keys(n, all_doors);
+				F.subkey[N] |= F.subkey[n];
 			}
 		}
 
-		N->subkey = N->key;
-		for (auto n : N->C) N->subkey |= n->subkey;
+		// Common: Children may be merged if they meet the following:
+		//     - no doors
+		//     - the keys don't open any doors
+		int merge_free_leaves(index_t N, mask_t all_doors) {
+			int cost = 0;
 
-		return cost;
-	}
+			for (auto n : F.children(N)) {
+				cost += merge_free_leaves(n, all_doors);
+			}
 
-	// Part 1: Branches with no doors can be taken all-or-nothing
-	int flatten_free_branches(node *N) {
-		int cost = 0;
-		N->subkey = N->key;
-		for (auto n : N->C) {
-			if (!n->subdoor) {
-				cost += n->flatten(KM);
-			} else {
-				cost += flatten_free_branches(n);
+			auto it = F.children(N).begin();
+			index_t t = -1;
+
+			for (auto n : F.children(N)) {
+				if ((F.subkey[n] & all_doors) || F.subdoor[n]) {
+					*it++ = n;
+				} else if (t == index_t(-1)) {
+					t = n;
+				} else {
+					F.key[t] |= F.key[n];
+					F.max_depth[t] = std::max(F.max_depth[t], F.max_depth[n]);
+					F.cost[t] += F.cost[n];
+				}
 			}
-			N->subkey |= n->subkey;
-		}
-		return cost;
-	}
 
-	// Part 1: Keys required for opening doors must backtrack,
-	// so they can be taken greedily
-	int merge_free_door_keys(node *N, mask_t all_doors) {
-		int cost = 0;
+			if (t != index_t(-1)) {
+				cost += (F.cost[t] - F.max_depth[t]) * 2;
+				F.cost[t] = F.max_depth[t];
+				if (F.key[t]) F.key[t] = bit(KM.join(F.key[t]));
+				*it++ = t;
+			}
+
+			F.truncate(N, it);
 
-		for (auto n : N->C) {
-			cost += merge_free_door_keys(n, all_doors);
+			// Merge upward (a door is allowed on this node)
+			if (F.Count[N] == 1 && !(F.subkey[N] & all_doors)) {
+				auto n = F.children(N)[0];
+				if (!F.subdoor[n]) {
+					F.Count[N] = 0;
+					if (F.key[n]) F.key[N] = bit(KM.join(F.key[N] | F.key[n]));
+					F.cost[N] += F.cost[n];
+				}
+			}
+
+			rebuild_subkey(N);
+
+			return cost;
 		}
 
-		auto it = N->C.begin();
-		for (auto n : N->C) {
-			if (n->subdoor || (n->subkey & ~all_doors)) {
-				*it++ = n;
-			} else {
-				N->key |= n->key;
-				cost += n->cost * 2;
-				delete n;
+		// Part 1: Branches with no doors can be taken all-or-nothing
+		int flatten_free_branches(index_t N) {
+			int cost = 0;
+			F.subkey[N] = F.key[N];
+			for (auto n : F.children(N)) {
+				if (!F.subdoor[n]) {
+					cost += F.flatten(n, KM);
+				} else {
+					cost += flatten_free_branches(n);
+				}
+				F.subkey[N] |= F.subkey[n];
 			}
+			return cost;
 		}
-		N->C.erase(it, N->C.end());
 
-		if (N->key) N->key = 1 << KM.join(N->key);
+		// Part 1: Keys required for opening doors must backtrack,
+		// so they can be taken greedily
+		int merge_free_door_keys(index_t N, mask_t all_doors) {
+			int cost = 0;
 
-		N->subkey = N->key;
-		for (auto n : N->C) N->subkey |= n->subkey;
+			for (auto n : F.children(N)) {
+				cost += merge_free_door_keys(n, all_doors);
+			}
 
-		return cost;
-	}
+			auto it = F.children(N).begin();
+			for (auto n : F.children(N)) {
+				if (F.subdoor[n] || (F.subkey[n] & ~all_doors)) {
+					*it++ = n;
+				} else {
+					F.key[N] |= F.key[n];
+					cost += F.cost[n] * 2;
+				}
+			}
+			F.truncate(N, it);
 
-	// Part 2: Greedily take branches satisfying the following:
-	//     - no doors
-	//     - no backtracking possible
-	//     - not the deepest branch among siblings
-	int merge_free_branches(node *N) {
-		int max_depth = N->max_depth - N->cost;
-		int cost = 0;
+			if (F.key[N]) F.key[N] = bit(KM.join(F.key[N]));
 
-		auto it = N->C.begin();
-		for (auto n : N->C) {
-			if ((n->max_depth < max_depth) && !n->subdoor) {
-				cost += n->flatten(KM);
-				cost += n->cost * 2;
-				N->key |= n->key;
-				delete n;
-			} else {
-				*it++ = n;
+			rebuild_subkey(N);
+
+			return cost;
+		}
+
+		// Part 2: Greedily take branches satisfying the following:
+		//     - no doors
+		//     - no backtracking possible
+		//     - not the deepest branch among siblings
+		int merge_free_branches(index_t N) {
+			int max_depth = F.max_depth[N] - F.cost[N];
+			int cost = 0;
+
+			auto it = F.children(N).begin();
+			for (auto n : F.children(N)) {
+				if ((F.max_depth[n] < max_depth) && !F.subdoor[n]) {
+					cost += F.flatten(n, KM);
+					cost += F.cost[n] * 2;
+					F.key[N] |= F.key[n];
+				} else {
+					*it++ = n;
+				}
+			}
+			F.truncate(N, it);
+
+			// Continue search only if one child (no backtracking)
+			if (F.Count[N] == 1) {
+				cost += merge_free_branches(F.children(N)[0]);
 			}
+
+			if (F.key[N]) F.key[N] = bit(KM.join(F.key[N]));
+
+			rebuild_subkey(N);
+
+			return cost;
 		}
-		N->C.erase(it, N->C.end());
 
-		// Continue search only if one child (no backtracking)
-		if (N->C.size() == 1) {
-			cost += merge_free_branches(N->C[0]);
+		void renumber_doors() {
+			all_doors = 0;
+			for (auto n : F.R) all_doors |= F.renumber_doors(n, KM);
 		}
+	};
 
-		if (N->key) N->key = 1 << KM.join(N->key);
+	static output_t solve(grid_t G) {
+		optimizer O1{loader::load(std::move(G))};
 
-		N->subkey = N->key;
-		for (auto n : N->C) N->subkey |= n->subkey;
+		int cost = O1.common(), robots = O1.F.R.size();
+		bool hub = O1.F.hub;
 
-		return cost;
-	}
+		auto O2 = O1;
+
+		std::string part1 = "?", part2 = "?";
+		if (hub || robots == 1) {
+			// From a hub, the robot first steps diagonally into a quadrant
+			int c = cost + O1.part1_only() + (hub ? 2 : 0);
+			part1 = std::to_string(c + solver<1>{O1.F}());
+		}
+		if (hub || robots > 1) {
+			int c = cost + O2.part2_only();
+			part2 = std::to_string(c + solver<2>{O2.F}());
+		}
 
-	void renumber_doors() {
-		all_doors = 0;
-		for (auto n : R) all_doors |= n->renumber_doors(KM);
+		return { part1, part2 };
 	}
 };
 
 }
 
-output_t day18(input_t in) {
-	optimizer O1{loader::load(in)};
-
-	int part1 = O1.common(), part2 = part1;
-
-	auto O2 = O1.clone();
-
-	part1 += O1.part1_only() + 2;
-	part1 += solver<1>{O1.R}();
-
-	part2 += O2.part2_only();
-	part2 += solver<2>{O2.R}();
+template<typename mask_t>
+static output_t solve(grid_t G, int robots) {
+	if (robots <= 4) {
+		return vault<mask_t, 4>::solve(std::move(G));
+	} else {
+		return vault<mask_t, MAX_ROBOTS>::solve(std::move(G));
+	}
+}
 
-	return { part1, part2 };
+output_t day18(input_t in) {
+	auto G = read_grid(in);
+
+	// Use the narrowest key set which fits the vault, and room for
+	// every robot's position in each state
+	int n_keys = 0, robots = 0;
+	for (auto &s : G) {
+		for (auto c : s) {
+			n_keys = std::max(n_keys, key_id(c) + 1);
+			n_keys = std::max(n_keys, door_id(c) + 1);
+			robots += c == '@';
+		}
+	}
+	assert(n_keys <= MAX_KEYS, "too many keys");
+	assert(robots <= MAX_ROBOTS, "too many robots");
+
+	if (n_keys <= 32) {
+		return solve<uint32_t>(std::move(G), robots);
+	} else if (n_keys <= 64) {
+		return solve<uint64_t>(std::move(G), robots);
+	} else if (n_keys <= 128) {
+		return solve<unsigned __int128>(std::move(G), robots);
+	} else {
+		return solve<wide_mask<4>>(std::move(G), robots);
+	}
 }
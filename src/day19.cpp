@@ -29,8 +29,32 @@ struct frac {
 	int64_t floor() const                 { return n / d; }
 };
 
+// Runs the beam program on one reusable VM, remembering answers
+struct prober {
+	cpu_t C;
+	std::vector<int64_t> image;
+	std::unordered_map<uint64_t, bool> memo;
+	int runs = 0, repeats = 0;
+
+	prober(const std::vector<int64_t> &V) : C(V), image(C.V) { }
+
+	bool operator() (int x, int y) {
+		auto [ it, added ] = memo.try_emplace(uint64_t(uint32_t(x)) << 32 | uint32_t(y));
+		if (!added) {
+			repeats++;
+			return it->second;
+		}
+		runs++;
+		C.reset(image);
+		C.run(); *C.input = x;
+		C.run(); *C.input = y;
+		C.run();
+		return it->second = C.output;
+	}
+};
+
 struct solver {
-	decltype(read_intcode(input_t{})) V;
+	prober probe;
 
 	/* Slopes of four lines that closely approximate the beam,
 	 * and satisfy the inequality: 0 < a0 < a1 <= b0 < b1 < 1
@@ -52,8 +76,7 @@ struct solver {
 	 */
 	bool swap = false;
 
-	solver(input_t in, int x) {
-		V = read_intcode(in);
+	solver(input_t in, int x) : probe(read_intcode(in)) {
 		frac p;
 		// Search for the beam
 		std::tie(p, swap) = find_beam(x);
@@ -92,11 +115,7 @@ struct solver {
 	// Run the Intcode program to test whether (x,y) is in the beam
 	bool test_point(int x, int y) {
 		if (swap) std::swap(x, y);
-		cpu_t C(V);
-		C.run(); *C.input = x;
-		C.run(); *C.input = y;
-		C.run();
-		return C.output;
+		return probe(x, y);
 	}
 
 	/* Search for any point other than (0,0) inside the beam,
@@ -193,5 +212,7 @@ output_t day19(input_t in) {
 	int part1 = S.part1(49); // count 50x50 region
 	int part2 = S.part2(99); // find 100x100 area in beam
 
+	stat("%d probes, %d repeated", S.probe.runs, S.probe.repeats);
+
 	return { part1, part2 };
 }
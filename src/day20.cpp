@@ -1,3 +1,4 @@
+#include <string_view>
 #include "advent2019.h"
 
 // Day 20: Donut Maze
@@ -9,12 +10,12 @@ struct pt {
 	int y, x;
 	pt(int y, int x) : y(y), x(x) { }
 	pt operator+ (const pt &o) const { return { y+o.y, x+o.x }; }
-	pt operator- (const pt &o) const { return { y-o.y, x-o.x }; }
-	pt operator- () const { return { -y, -x }; }
-	pt right() const      { return {  x, -y }; }
-	pt left() const       { return { -x,  y }; }
+	bool operator!= (const pt &o) const { return y != o.y || x != o.x; }
 };
 
+// Unit steps in each direction
+const pt Dir[] = { { -1, 0 }, { 0, 1 }, { 1, 0 }, { 0, -1 } };
+
 // Describes a move in the maze: portal id, distance, z-coordinate
 struct move {
 	int id, cost, z;
@@ -22,233 +23,447 @@ struct move {
 	bool operator< (const move &o) const { return cost > o.cost; }
 };
 
-// A little memory safety in case of malformed input
+// Read-only view of the input, indexed by row; out-of-range
+// reads return a space
 struct grid {
-	std::vector<std::string::iterator> Row = { };
-	std::string s;
-
-	// Need to copy the input because we modify it
-	grid(input_t in) : s(in.s, in.len) {
-		// Index the string by row
-		Row.push_back(s.begin());
-		for (auto p = s.begin(); p != s.end(); p++) {
-			if (*p == '\n') Row.push_back(p + 1);
-		}
-		if (Row.back() != s.end()) {
-			Row.push_back(s.end());
+	std::vector<std::string_view> Row = { };
+	int width = 0;
+
+	grid(input_t in) {
+		std::string_view s(in.s, in.len);
+		while (!s.empty()) {
+			auto eol = s.find('\n');
+			if (eol == s.npos) eol = s.size();
+			Row.push_back(s.substr(0, eol));
+			width = std::max(width, int(eol));
+			s.remove_prefix(std::min(eol + 1, s.size()));
 		}
 	}
 
-	char& at(int y, int x) {
-		static char space = ' ';
-		if (y < 0 || y + 1 >= Row.size()) return space;
-		auto r = &Row[y];
-		if (x < 0 || r[0] + x >= r[1]) return space;
-		return r[0][x];
+	bool inside(pt p) const {
+		return unsigned(p.y) < Row.size() && unsigned(p.x) < Row[p.y].size();
 	}
 
-	char& operator[] (pt p) {
-		return at(p.y, p.x);
+	char operator[] (pt p) const {
+		return inside(p) ? Row[p.y][p.x] : ' ';
 	}
-};
 
-struct solver {
-	// Position on perimeter to begin looking for portals
-	const pt MAZE_BORDER = pt{2,3};
+	// Flat cell index, for side tables
+	int index(pt p) const {
+		return p.y * width + p.x;
+	}
 
-	// Avoid overflowing signed char in grid
-	const int MAX_LABELS = 50;
+	int size() const {
+		return Row.size() * width;
+	}
+};
 
-	grid G;
+// Priority queue for small integer keys that are never less than
+// the last key popped: a ring of buckets indexed by key, which
+// doubles whenever a key lands too far ahead.  Buckets are linked
+// lists threaded through one array of entries.
+template<typename T>
+struct bucket_queue {
+	struct entry {
+		T v;
+		int next;
+	};
+	std::vector<entry> E = { };
+	std::vector<int> Head = std::vector<int>(64, -1);
+	size_t key = 0, count = 0, mask = 63;
+
+	bool empty() const {
+		return !count;
+	}
 
-	// Mapping from portal label to id+1
-	std::unordered_map<int,int> Label = { };
-	int n_labels = 0;
+	void push(size_t k, const T &v) {
+		if (k - key > mask) grow(k - key);
+		auto &h = Head[k & mask];
+		E.push_back({ v, h });
+		h = E.size() - 1;
+		count++;
+	}
 
-	// Portals on perimeter; value is {location, direction},
-	// where direction points into the maze
-	std::vector<std::pair<pt,pt>> Portals = { };
+	T pop() {
+		while (Head[key & mask] < 0) key++;
+		auto &h = Head[key & mask];
+		auto &e = E[h];
+		h = e.next;
+		count--;
+		return e.v;
+	}
+
+	void grow(size_t span) {
+		size_t old_mask = mask;
+		while (mask < span) mask = mask * 2 + 1;
+		std::vector<int> Old(mask + 1, -1);
+		std::swap(Head, Old);
+		for (size_t i = 0; i <= old_mask; i++) {
+			size_t k = key + ((i - key) & old_mask);
+			auto &h = Head[k & mask];
+			for (int j = Old[i], next; j >= 0; j = next) {
+				next = E[j].next;
+				E[j].next = h;
+				h = j;
+			}
+		}
+	}
+};
 
-	// Valid moves from each portal
-	std::vector<std::vector<move>> Move = { };
+// Compressed sparse row adjacency list
+struct csr {
+	std::vector<int> First = { 0 };
+	std::vector<move> Edge = { };
 
-	// start (AA) and goal (ZZ) portal id
-	int start = 0, goal = 0;
+	span<const move> operator[] (int id) const {
+		return { Edge.data() + First[id], Edge.data() + First[id + 1] };
+	}
+};
 
-	solver(input_t in) : G(in) {
-		scan_for_portals();
+struct solver {
+	const grid G;
+
+	// Portal openings.  Inner portals descend a level; partner is
+	// the opening on the other side, or -1 for AA, ZZ and strays.
+	struct portal {
+		bool inner;
+		int partner;
+	};
+	std::vector<portal> Portals = { };
+
+	// Corridor graph node at each cell index; openings come first,
+	// numbered the same as Portals, followed by junctions
+	std::unordered_map<int,int> Node = { };
+	std::vector<pt> Where = { };
+	std::vector<bool> Tree = { };
+	csr Hall;
+
+	// Open neighbors of each floor tile, zero once filled in
+	const uint8_t OPENING = 0x80;
+	std::vector<uint8_t> Deg;
+
+	// Moves from each opening, landing on the far side of the next
+	// portal, and the cheapest move that climbs a level
+	csr Move;
+	int min_up = INT32_MAX;
+
+	// Distance from each opening to ZZ, ignoring levels
+	std::vector<int> ToGoal;
+
+	// start (AA) and goal (ZZ) opening
+	int start = -1, goal = -1;
+
+	solver(input_t in) : G(in), Deg(G.size()) {
+		auto ends = scan_for_portals();
+		if (start < 0 || goal < 0) abort();
+		build_halls(std::move(ends));
 		pathfind();
-		start = Label[L('A','A')], goal = Label[L('Z','Z')];
-		if (!start-- || !goal--) abort();
+		find_goal();
+	}
+
+	// Any character other than wall, floor or space is part of a label
+	static bool is_label(char c) {
+		return c != '#' && c != '.' && c != ' ' && c != '\r';
 	}
 
 	// Encode a label for unordered_map key
 	static int L(char a, char b) {
-		return (a << 8) | b;
+		return (uint8_t(a) << 8) | uint8_t(b);
+	}
+
+	// Find every floor tile with a label next to it.  The label is
+	// on the outer edge if the tile beyond it is off the map.  Also
+	// counts open neighbors of each floor tile and returns the dead
+	// ends; openings are flagged so they are never filled.
+	std::vector<pt> scan_for_portals() {
+		std::unordered_map<int,int> Label;
+		std::vector<pt> Ends;
+
+		for (int y = 0; y < G.Row.size(); y++) {
+			for (int x = 0; x < G.Row[y].size(); x++) {
+				pt p{y, x};
+				if (G.Row[y][x] != '.') continue;
+				auto &d = Deg[G.index(p)];
+				for (auto step : Dir) {
+					char a = G[p + step];
+					if (a == '.') d++;
+					if (!is_label(a) || (d & OPENING)) continue;
+					char b = G[p + step + step];
+					if (!is_label(b)) continue;
+					if (step.x + step.y < 0) std::swap(a, b);
+
+					int id = Portals.size();
+					bool inner = G.inside(p + step + step + step);
+					Portals.push_back({ inner, -1 });
+					Node[G.index(p)] = id;
+					Where.push_back(p);
+					d |= OPENING;
+
+					auto [ it, added ] = Label.emplace(L(a,b), id);
+					if (!added) {
+						auto &other = Portals[it->second];
+						if (other.partner >= 0) abort();
+						other.partner = id;
+						Portals.back().partner = it->second;
+					}
+				}
+
+				if (d == 1) Ends.push_back(p);
+			}
+		}
+
+		if (auto it = Label.find(L('A','A')); it != Label.end()) start = it->second;
+		if (auto it = Label.find(L('Z','Z')); it != Label.end()) goal = it->second;
+
+		return Ends;
 	}
 
-	// Read a label off the map and return an id for it.
-	// Also records the label id on the map using characters
-	// starting with lowercase 'a'.
-	int scan_label(pt p, pt step) {
-		char a = G[p], b = G[p + step];
-		if (step.x + step.y < 0) std::swap(a, b);
-		auto &l = Label[L(a,b)];
-		if (!l) l = ++n_labels;
-		if (n_labels > MAX_LABELS) abort();
-		G[p] = 'a' + l - 1;
-		return l - 1;
+	bool open(pt p) const {
+		return G[p] == '.' && Deg[G.index(p)];
 	}
 
-	// Walk around the perimeter of the map looking for portals
-	void scan_for_portals() {
-		pt p = MAZE_BORDER, step{0,1};
-		for (int turn = 0; turn < 4; p = p + step) {
-			auto c = G[p];
-			if (c == '.') {
-				auto left = step.left();
-				scan_label(p + left, left);
-				Portals.emplace_back(p, step.right());
-				Move.emplace_back();
-			} else if (c != '#') {
-				p = p - step;
-				step = step.right();
-				turn++;
+	// Reduce the maze to a weighted graph of openings and junctions.
+	// Dead ends without a portal are filled in first, since no
+	// shortest path between portals can use them.
+	void build_halls(std::vector<pt> Q) {
+		// Dead-end filling; a filled tile has degree zero
+		while (!Q.empty()) {
+			auto p = Q.back();
+			Q.pop_back();
+			if (Deg[G.index(p)] != 1) continue;
+			Deg[G.index(p)] = 0;
+			for (auto step : Dir) {
+				auto q = p + step;
+				if (open(q) && --Deg[G.index(q)] == 1) Q.push_back(q);
+			}
+		}
+
+		// Follow each corridor out of each node to the next node.
+		// Junctions become nodes as the corridors reach them.
+		for (int n = 0; n < Where.size(); n++) {
+			for (auto step : Dir) {
+				pt prev = Where[n], p = prev + step;
+				if (!open(p)) continue;
+				int len = 1;
+				for (; Deg[G.index(p)] == 2; len++) {
+					for (auto s : Dir) {
+						auto q = p + s;
+						if (open(q) && q != prev) {
+							prev = p, p = q;
+							break;
+						}
+					}
+				}
+				auto [ it, added ] = Node.emplace(G.index(p), Where.size());
+				if (added) Where.push_back(p);
+				Hall.Edge.emplace_back(it->second, len, 0);
 			}
+			Hall.First.push_back(Hall.Edge.size());
+		}
+
+		// Flag the nodes of components without loops, which can be
+		// searched without a priority queue
+		Tree.resize(Where.size());
+		std::vector<bool> Seen(Where.size());
+		std::vector<int> S, C;
+		for (int root = 0; root < Where.size(); root++) {
+			if (Seen[root]) continue;
+			Seen[root] = true;
+			S.assign(1, root);
+			C.clear();
+			size_t edges = 0;
+			while (!S.empty()) {
+				int n = S.back();
+				S.pop_back();
+				C.push_back(n);
+				edges += Hall[n].size();
+				for (auto e : Hall[n]) {
+					if (!Seen[e.id]) {
+						Seen[e.id] = true;
+						S.push_back(e.id);
+					}
+				}
+			}
+			bool tree = edges == 2 * (C.size() - 1);
+			for (auto n : C) Tree[n] = tree;
 		}
 	}
 
-	// Pathfind starting from each of the portals on the perimeter;
-	// if two outer portals are connected, skip the second one
+	// Shortest paths from each opening to the others reachable on
+	// foot.  The searches are independent, so they are spread across
+	// threads and gathered into a CSR array afterward.
 	void pathfind() {
-		int id = 0;
-		for (auto [ p, step ] : Portals) {
-			if (G[p] == '.') {
-				std::vector<move> W = { { id, 0, 0 } };
-				pathfind(p, step, 0, W, 0);
+		int n = Portals.size(), T = worker_count(n, 16);
+		std::vector<std::vector<move>> Out(T);
+		std::vector<int> Up(T, INT32_MAX);
+		Move.First.resize(n + 1);
+
+		// Each thread takes a contiguous range of openings, so its
+		// moves are already in CSR order
+		parallel_for(T, n, [&](int t, size_t begin, size_t end) {
+			std::vector<int> Dist(Where.size(), INT32_MAX), Touched;
+			std::vector<move> Q;
+			for (int id = begin; id < end; id++) {
+				// Nothing leads out of ZZ, nothing lands on a stray
+				if (id != goal && (id == start || Portals[id].partner >= 0)) {
+					pathfind(id, Dist, Touched, Q, Out[t], Up[t]);
+				}
+				Move.First[id + 1] = Out[t].size();
 			}
-			id++;
+		});
+
+		Move.Edge = std::move(Out[0]);
+		for (int t = 1, id = n / T; t < T; t++) {
+			int base = Move.Edge.size();
+			for (; id < n * (t + 1) / T; id++) Move.First[id + 1] += base;
+			Move.Edge.insert(Move.Edge.end(), Out[t].begin(), Out[t].end());
 		}
+		min_up = *std::min_element(Up.begin(), Up.end());
 	}
 
-	void pathfind(pt p, pt step, int depth, std::vector<move> &W, int base) {
-		char c = G[p];
-
-		if (c >= 'a' && c - 'a' < n_labels) {
-			// Outer portal
-			G[p - step] = '#'; // prevent redundant search
-			W.emplace_back(c - 'a', depth - 1, 0);
-		} else if (c >= 'A' && c <= 'Z') {
-			// Inner portal
-			int id = scan_label(p, step);
-			W.emplace_back(id, depth, 1);
+	void pathfind(int src, std::vector<int> &Dist, std::vector<int> &Touched, std::vector<move> &Q, std::vector<move> &out, int &up) {
+		// Step through the portal, or stop at ZZ
+		auto arrive = [&](int id, int cost) {
+			if (id >= Portals.size() || id == src) return;
+			auto &portal = Portals[id];
+			if (id == goal) {
+				out.emplace_back(goal, cost, 0);
+			} else if (portal.partner >= 0) {
+				out.emplace_back(portal.partner, cost + 1, portal.inner ? 1 : -1);
+				if (!portal.inner) up = std::min(up, cost + 1);
+			}
+		};
+
+		if (Tree[src]) {
+			// Only one path to each node; z holds the node we came from
+			Q.assign(1, { src, 0, -1 });
+			while (!Q.empty()) {
+				auto p = Q.back();
+				Q.pop_back();
+				arrive(p.id, p.cost);
+				for (auto e : Hall[p.id]) {
+					if (e.id != p.z) Q.emplace_back(e.id, p.cost + e.cost, p.id);
+				}
+			}
+			return;
 		}
 
-		if (c != '.') return;
-
-		// Branch left, forward, right
-		step = -step;
-		for (int i = 0; i < 3; i++) {
-			int pivot = W.size();
-			step = step.right();
-			pathfind(p + step, step, depth + 1, W, pivot);
-
-			// Find pairwise distances between old/new portals
-			for (int ia = base; ia < pivot; ia++) {
-				auto &a = W[ia];
-				for (int ib = pivot; ib < W.size(); ib++) {
-					auto &b = W[ib];
-					int cost = a.cost + b.cost - 2 * depth;
-					Move[a.id].emplace_back(b.id, cost, b.z - a.z);
-					Move[b.id].emplace_back(a.id, cost, a.z - b.z);
+		Q.assign(1, { src, 0, 0 });
+		Dist[src] = 0;
+		Touched.assign(1, src);
+
+		while (!Q.empty()) {
+			std::pop_heap(Q.begin(), Q.end());
+			auto p = Q.back();
+			Q.pop_back();
+			if (p.cost != Dist[p.id]) continue;
+			arrive(p.id, p.cost);
+
+			for (auto e : Hall[p.id]) {
+				int cost = p.cost + e.cost;
+				if (cost < Dist[e.id]) {
+					if (Dist[e.id] == INT32_MAX) Touched.push_back(e.id);
+					Dist[e.id] = cost;
+					Q.emplace_back(e.id, cost, 0);
+					std::push_heap(Q.begin(), Q.end());
 				}
 			}
 		}
+
+		for (auto id : Touched) Dist[id] = INT32_MAX;
 	}
 
-	/* We could almost solve part1 by taking the minimum distance
-	 * from AA to ZZ across all depths in part2, but that search
-	 * terminates too early to guarantee a correct result.
-	 */
-	int part1() {
-		std::vector<int> D(n_labels, INT32_MAX);
-		std::priority_queue<move> Q;
+	// Dijkstra outward from ZZ over the corridor graph, with each
+	// portal a single step.  Levels are ignored, which makes this
+	// the answer to part1 and a lower bound for part2.
+	void find_goal() {
+		std::vector<int> D(Where.size(), INT32_MAX);
+		bucket_queue<move> Q;
 
-		D[start] = 0;
-		Q.emplace(start, 0, 0);
+		D[goal] = 0;
+		Q.push(0, { goal, 0, 0 });
 
 		while (!Q.empty()) {
-			auto p = Q.top();
-			Q.pop();
+			auto p = Q.pop();
+			if (p.cost != D[p.id]) continue;
 
-			if (p.id == goal) break;
-
-			for (auto m : Move[p.id]) {
-				move dst{m.id, p.cost + m.cost, 0};
-				if (dst.cost < D[dst.id]) {
-					D[dst.id] = dst.cost;
-					Q.push(dst);
+			auto relax = [&](int id, int cost) {
+				if (cost < D[id]) {
+					D[id] = cost;
+					Q.push(cost, { id, cost, 0 });
 				}
+			};
+			for (auto e : Hall[p.id]) relax(e.id, p.cost + e.cost);
+			if (p.id < Portals.size() && Portals[p.id].partner >= 0) {
+				relax(Portals[p.id].partner, p.cost + 1);
 			}
 		}
 
-		return D[goal];
+		D.resize(Portals.size());
+		ToGoal = std::move(D);
+	}
+
+	int part1() {
+		return ToGoal[start];
 	}
 
-	// Use bidirectional search to reduce number of nodes expanded
+	/* A* over (level, opening).  Getting back to the surface from
+	 * level z takes at least z outward moves, each costing at least
+	 * min_up, and the path can be no shorter than it would be with
+	 * levels ignored.  Both bounds are consistent, and so is their
+	 * maximum.  Deep levels are only explored once the shallow ones
+	 * cost more.
+	 */
 	int part2() {
-		std::vector<std::vector<std::pair<int,int>>> D;
-		std::priority_queue<move> Qa, Qz;
+		const int n = Portals.size();
+		// With no way back out, going deeper is a dead end
+		const bool deeper = min_up != INT32_MAX;
 
-		auto expand_D = [&] () {
-			D.emplace_back(n_labels, std::make_pair(INT32_MAX,INT32_MAX));
+		auto heuristic = [&](const move &m) {
+			return std::max(ToGoal[m.id], deeper ? m.z * min_up : 0);
 		};
 
-		expand_D();
-		D[0][start].first = 0;
-		D[0][goal].second = 0;
-
-		Qa.emplace(start, 0, 0);
-		Qz.emplace(goal, 0, 0);
+		// Distances indexed by level * n + id; the vector's capacity
+		// grows geometrically as deeper levels are reached
+		int levels = 1;
+		std::vector<int> D(n, INT32_MAX);
+		bucket_queue<move> Q;
 
+		size_t expanded = 0;
 		int answer = INT32_MAX;
-		int ta = 0, tz = 0; // top-of-queue costs
-
-		while (ta + tz < answer && !(Qa.empty() && Qz.empty())) {
-			if (!Qa.empty()) ta = Qa.top().cost;
-			if (!Qz.empty()) tz = Qz.top().cost;
 
-			// Keep the queues balanced
-			bool which = !Qa.empty() && (Qa.size() <= Qz.size());
-
-			auto &Q = which ? Qa : Qz;
-
-			auto p = Q.top();
-			Q.pop();
-
-			auto [ cost_a, cost_z ] = D[p.z][p.id];
-			if (p.cost != (which ? cost_a : cost_z)) continue;
+		if (ToGoal[start] != INT32_MAX) {
+			D[start] = 0;
+			Q.push(heuristic({ start, 0, 0 }), { start, 0, 0 });
+		}
 
-			// Candidate answer
-			if (cost_a != INT32_MAX && cost_z != INT32_MAX) {
-				answer = std::min(answer, cost_a + cost_z);
-				continue;
+		while (!Q.empty()) {
+			auto p = Q.pop();
+			if (p.cost != D[p.z * n + p.id]) continue;
+			if (p.id == goal && !p.z) {
+				answer = p.cost;
+				break;
 			}
+			expanded++;
 
 			for (auto m : Move[p.id]) {
 				move dst{m.id, p.cost + m.cost, p.z + m.z};
-				if (dst.z < 0) continue;
-				if (dst.z == D.size()) expand_D();
-
-				auto &d = D[dst.z][dst.id];
-				auto &cost = which ? d.first : d.second;
-				if (dst.cost < cost) {
-					cost = dst.cost;
-					Q.push(dst);
+				if (dst.z < 0 || (dst.z && !deeper)) continue;
+				if (ToGoal[dst.id] == INT32_MAX) continue;
+				if (dst.z == levels) {
+					D.resize(++levels * n, INT32_MAX);
+				}
+
+				auto &d = D[dst.z * n + dst.id];
+				if (dst.cost < d) {
+					d = dst.cost;
+					Q.push(dst.cost + heuristic(dst), dst);
 				}
 			}
 		}
 
+		stat("Part 2: %zu states expanded, %d levels reached", expanded, levels);
+
 		return answer;
 	}
 };
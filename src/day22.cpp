@@ -4,28 +4,99 @@
 
 namespace {
 
+// Montgomery arithmetic modulo an odd MOD < 2^63, with R = 2^64
+template<int64_t MOD>
+struct montgomery {
+	static_assert(MOD & 1, "modulus must be odd");
+
+	// -MOD^-1 mod 2^64 by Newton's iteration; each step doubles the
+	// number of correct low bits, starting from 3 (x*x == 1 mod 8)
+	static constexpr uint64_t neg_inv() {
+		uint64_t x = MOD;
+		for (int i = 0; i < 5; i++) x *= 2 - MOD * x;
+		return -x;
+	}
+	static constexpr uint64_t NINV = neg_inv();
+	static constexpr uint64_t R2 = -__uint128_t(MOD) % MOD;
+
+	// t * R^-1 mod MOD, for t < MOD * 2^64
+	static uint64_t reduce(__uint128_t t) {
+		uint64_t m = uint64_t(t) * NINV;
+		uint64_t r = (t + __uint128_t(m) * MOD) >> 64;
+		return r >= uint64_t(MOD) ? r - MOD : r;
+	}
+
+	static uint64_t mul(uint64_t a, uint64_t b) {
+		return reduce(__uint128_t(a) * b);
+	}
+
+	static uint64_t to(uint64_t a) {
+		return mul(a, R2);
+	}
+
+	static uint64_t add(uint64_t a, uint64_t b) {
+		a += b;
+		return a >= uint64_t(MOD) ? a - MOD : a;
+	}
+};
+
+// The multiplier is kept in Montgomery form, the offset is not; a
+// Montgomery product of the two is then an ordinary residue, so no
+// conversions are needed outside of construction
 template<int64_t MOD>
 struct shuf {
-	__int128_t add, mul;
-	shuf() : add(0), mul(1) { }
+	using M = montgomery<MOD>;
+	uint64_t add, mul;
+	shuf() : add(0), mul(M::to(1)) { }
 	shuf(int64_t add, int64_t mul) :
-		add(add < 0 ? MOD + add : add), mul(mul < 0 ? MOD + mul : mul)
+		add(add < 0 ? MOD + add : add),
+		mul(M::to(mul < 0 ? MOD + mul : mul))
 	{
 	}
 
 	int64_t operator () (int64_t n) const {
-		return (add + mul * n) % MOD;
+		return M::add(add, M::mul(mul, n));
 	}
 
 	shuf operator * (const shuf &o) const {
 		shuf r;
 		r.add = (*this)(o.add);
-		r.mul = mul * o.mul % MOD;
+		r.mul = M::mul(mul, o.mul);
+		return r;
+	}
+
+	// Apply one more technique after this shuffle
+	void cut(int64_t n) {
+		n %= MOD;
+		add = M::add(add, n > 0 ? MOD - n : -n);
+	}
+
+	void reverse() {
+		add = MOD - 1 - add;
+		mul = mul ? MOD - mul : 0;
+	}
+
+	void deal(int64_t n) {
+		uint64_t m = M::to(n);
+		add = M::mul(m, add);
+		mul = M::mul(m, mul);
+	}
+
+	// Undo this shuffle: x = (y - add) / mul, with the division done
+	// by Fermat's little theorem on the multiplier alone
+	shuf inverse() const {
+		shuf r;
+		r.mul = M::to(1);
+		for (uint64_t q = mul, e = MOD - 2; e; e >>= 1, q = M::mul(q, q)) {
+			if (e & 1) r.mul = M::mul(q, r.mul);
+		}
+		uint64_t a = M::mul(r.mul, add);
+		r.add = a ? MOD - a : 0;
 		return r;
 	}
 
 	shuf pow(int64_t e) const {
-		if (e < 0) e = MOD - 1 + e;
+		if (e < 0) return inverse().pow(-e);
 		shuf r;
 		for (shuf q = *this; e; e >>= 1, q = q * q) {
 			if (e & 1) r = q * r;
@@ -34,47 +105,97 @@ struct shuf {
 	}
 };
 
+// Shuffle with the multiplier kept in Shoup form, for evaluating many
+// indices: w * x mod MOD = w * x - hi(w' * x) * MOD, up to one
+// correction, where w' = floor(w * 2^64 / MOD); no division per index
+template<int64_t MOD>
+struct linear_map {
+	uint64_t add, mul, mul_q;
+
+	linear_map(const shuf<MOD> &s) :
+		add(s.add), mul(montgomery<MOD>::reduce(s.mul)),
+		mul_q((__uint128_t(mul) << 64) / MOD)
+	{
+	}
+
+	uint64_t operator () (uint64_t x) const {
+		uint64_t q = (__uint128_t(mul_q) * x) >> 64;
+		uint64_t r = mul * x - q * MOD;
+		r -= r >= uint64_t(MOD) ? MOD : 0;
+		r += add;
+		return r - (r >= uint64_t(MOD) ? MOD : 0);
+	}
+
+	// out[i] = (*this)(in[i]); out may alias in
+	void operator () (span<const uint64_t> in, uint64_t *out) const {
+		size_t n = in.size();
+		parallel_for(worker_count(n, 1 << 16), n, [&](int, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				out[i] = (*this)(in[i]);
+			}
+		});
+	}
+};
+
+// Forward and inverse maps of a composed shuffle, precomputed once
+template<int64_t MOD>
+struct deck {
+	linear_map<MOD> position, card;
+
+	deck(const shuf<MOD> &s) : position(s), card(s.inverse()) { }
+
+	// Position of each card after the shuffle
+	void position_of(span<const uint64_t> cards, uint64_t *out) const {
+		position(cards, out);
+	}
+
+	// Card at each position after the shuffle
+	void card_at(span<const uint64_t> positions, uint64_t *out) const {
+		card(positions, out);
+	}
+};
+
 }
 
 output_t day22(input_t in) {
-	enum { OP_MUL, OP_REV, OP_ADD };
-
 	shuf<10007> S1;
 	shuf<119315717514047> S2;
 
-	for (int n = 0, neg = 0, op = OP_MUL; in.len--; in.s++) {
-		uint8_t c = *in.s - '0';
-		if (c < 10) {
-			n = 10 * n + c;
-		} else if (*in.s == '-') {
-			neg = 1;
-		} else if (*in.s == 'u') { // cut
-			op = OP_ADD;
-		} else if (*in.s == 'k') { // new stack
-			op = OP_REV;
-		} else if (*in.s == '\n') {
-			if (neg) n = -n;
-			switch (op) {
-			    case OP_MUL:
-				S1 = decltype(S1){ 0, n} * S1;
-				S2 = decltype(S2){ 0, n} * S2;
-				break;
-			    case OP_ADD:
-				S1 = decltype(S1){-n, 1} * S1;
-				S2 = decltype(S2){-n, 1} * S2;
-				break;
-			    case OP_REV:
-				S1 = decltype(S1){-1,-1} * S1;
-				S2 = decltype(S2){-1,-1} * S2;
-				break;
-			}
-			n = neg = 0;
-			op = OP_MUL;
+	// Techniques are told apart by a fixed offset into each line:
+	//   "cut N", "deal into new stack", "deal with increment N"
+	const char *p = in.s, *end = in.s + in.len;
+	auto number = [&](const char *q) {
+		bool neg = *q == '-';
+		int64_t n = 0;
+		for (q += neg; uint8_t(*q - '0') < 10; q++) {
+			n = 10 * n + (*q - '0');
 		}
+		p = q;
+		return neg ? -n : n;
+	};
+	while (p + 4 < end) {
+		if (*p == 'c') {
+			int64_t n = number(p + 4);
+			S1.cut(n);
+			S2.cut(n);
+		} else if (p[5] == 'i') {
+			S1.reverse();
+			S2.reverse();
+			p += 19;
+		} else {
+			int64_t n = number(p + 20);
+			S1.deal(n);
+			S2.deal(n);
+		}
+		while (p < end && *p++ != '\n') { }
 	}
 
 	int64_t part1 = S1(2019);
-	int64_t part2 = S2.pow(-101741582076661)(2020);
+
+	// Card at position 2020 after the shuffle is repeated many times
+	deck<119315717514047> D2(S2.pow(101741582076661));
+	uint64_t query = 2020, part2;
+	D2.card_at({ &query, &query + 1 }, &part2);
 
 	return { part1, part2 };
 }
@@ -2,9 +2,23 @@
 
 // Day 24: Planet of Discord
 
+namespace {
+
+// Several recursion levels are stepped at once, one per 64-bit lane
+#ifdef __AVX512F__
+constexpr int LANES = 8;
+#else
+constexpr int LANES = 4;
+#endif
+
+typedef uint64_t vec_t __attribute__ ((vector_size (8 * LANES)));
+
+}
+
 // 2-bit SWAR saturating accumulate; second parameter can have
 // 0 or 1 in each of its fields
-static uint64_t sacc(uint64_t x, uint64_t a) {
+template<typename T>
+static T sacc(T x, T a) {
 	constexpr uint64_t MASK = 0x5555555555555555;
 	return ((x & ~MASK) | (x & MASK) + a) ^ (a & x & (x >> 1));
 }
@@ -20,17 +34,19 @@ static uint32_t even_bits(uint64_t grid) {
 }
 
 // Count the four neighbors
-static uint64_t neighbors4(uint64_t grid) {
-	uint64_t n = sacc(grid << 10, grid >> 10);
+template<typename T>
+static T neighbors4(T grid) {
+	T n = sacc(grid << 10, grid >> 10);
 	n = sacc(n, (grid & 0x0ff3fcff3fcff) << 2);
 	n = sacc(n, (grid & 0x3fcff3fcff3fc) >> 2);
 	return n;
 }
 
 // Apply life-or-death rule using neighbor counts in n
-static uint64_t life_or_death(uint64_t grid, uint64_t n, uint64_t mask) {
-	uint64_t survived =  grid & (n & ~(n >> 1));
-	uint64_t born     = ~grid & (n ^  (n >> 1));
+template<typename T>
+static T life_or_death(T grid, T n, uint64_t mask) {
+	T survived =  grid & (n & ~(n >> 1));
+	T born     = ~grid & (n ^  (n >> 1));
 	return (survived | born) & mask;
 }
 
@@ -39,8 +55,74 @@ static uint64_t next(uint64_t grid) {
 	return life_or_death(grid, neighbors4(grid), 0x1555555555555);
 }
 
+// Advance one step; the scratch state lets large grids step in place
+static void advance(uint64_t &grid, uint64_t &) {
+	grid = next(grid);
+}
+
+// First state to repeat, by Brent's algorithm: find the cycle length
+// with a hare that the tortoise jumps to at each power of two, then
+// walk two states that far apart until they meet
+template<typename T>
+static T first_repeat(const T &grid) {
+	T tortoise = grid, hare = grid, tmp = grid;
+	advance(hare, tmp);
+	int power = 1, cycle = 1;
+	for (; tortoise != hare; cycle++) {
+		if (power == cycle) {
+			tortoise = hare;
+			power *= 2;
+			cycle = 0;
+		}
+		advance(hare, tmp);
+	}
+
+	tortoise = hare = grid;
+	for (int i = 0; i < cycle; i++) {
+		advance(hare, tmp);
+	}
+	while (tortoise != hare) {
+		advance(tortoise, tmp);
+		advance(hare, tmp);
+	}
+	return tortoise;
+}
+
+namespace {
+
+// Alternative to first_repeat() which marks every state in a 2^25-bit
+// table (4 MiB), stepping each state only once.  A step is so cheap
+// that the cache misses into the table cost more than Brent's extra
+// steps, even when the table is reused across many start grids.
+struct seen_bitmap {
+	std::vector<uint64_t> W = std::vector<uint64_t>(1 << 19);
+
+	uint64_t first_repeat(uint64_t grid) {
+		uint64_t g = grid;
+		for (;; g = next(g)) {
+			uint32_t k = even_bits(g);
+			uint64_t bit = 1ULL << (k & 63);
+			if (W[k >> 6] & bit) break;
+			W[k >> 6] |= bit;
+		}
+
+		// Retrace the path to clear only the bits that were set
+		for (uint64_t h = grid; ; h = next(h)) {
+			uint32_t k = even_bits(h);
+			uint64_t bit = 1ULL << (k & 63);
+			if (!(W[k >> 6] & bit)) break;
+			W[k >> 6] &= ~bit;
+		}
+
+		return g;
+	}
+};
+
+}
+
 // Apply part 2 rule
-static uint64_t next(uint64_t inner, uint64_t grid, uint64_t outer) {
+template<typename T>
+static T next(T inner, T grid, T outer) {
 	// Outer border masks
 	constexpr uint64_t UMASK = 0x155;
 	constexpr uint64_t DMASK = UMASK << 40;
@@ -51,10 +133,10 @@ static uint64_t next(uint64_t inner, uint64_t grid, uint64_t outer) {
 	constexpr uint64_t IMASK   = 0x404404000;
 	constexpr uint64_t IUDMASK = 0x400004000;
 
-	uint64_t n = neighbors4(grid);
+	T n = neighbors4(grid);
 
 	// Outer grid neighbors
-	uint64_t oud = 0, olr = 0;
+	T oud = { }, olr = { };
 	oud |= -((outer >> 14) & 1) & UMASK;
 	oud |= -((outer >> 34) & 1) & DMASK;
 	olr |= -((outer >> 22) & 1) & LMASK;
@@ -64,9 +146,8 @@ static uint64_t next(uint64_t inner, uint64_t grid, uint64_t outer) {
 	n = sacc(n, olr);
 
 	// Inner grid neighbors
-	uint64_t iud = 0, ilr = 0;
-	iud = (inner & UMASK) << 10 | (inner & DMASK) >> 10;
-	ilr = (inner & LMASK) <<  2 | (inner & RMASK) >>  2;
+	T iud = (inner & UMASK) << 10 | (inner & DMASK) >> 10;
+	T ilr = (inner & LMASK) <<  2 | (inner & RMASK) >>  2;
 
 	n = sacc(n, ( iud                 | ilr      ) & IMASK);
 	n = sacc(n, ( iud >> 2            | ilr >> 10) & IMASK);
@@ -78,52 +159,262 @@ static uint64_t next(uint64_t inner, uint64_t grid, uint64_t outer) {
 	return life_or_death(grid, n, 0x1555554555555);
 }
 
-output_t day24(input_t in) {
-	// Represent the grid as a bit field, 2 bits per cell
-	uint64_t grid = 0, b = 1;
-	for (; in.len--; in.s++) {
-		switch (*in.s) {
-		    case '#': grid |= b;
-		    case '.': b <<= 2;
+// Simulate the recursive grids for the given number of minutes and
+// count the bugs.  Levels are stored innermost first in two zero-padded
+// buffers; each minute steps a whole vector of levels at a time from
+// one buffer into the other.  The active range [lo, hi) only grows,
+// so neither buffer ever holds stale bugs outside of it.
+static int64_t recursive(uint64_t grid, int minutes) {
+	std::vector<uint64_t> A, B;
+	size_t lo = 0, hi = 0;
+
+	// Recenter the active range in larger buffers
+	auto grow = [&]() {
+		size_t len = hi - lo, pad = len / 2 + 2 * LANES + 16;
+		std::vector<uint64_t> R(len + 2 * pad);
+		std::copy(A.begin() + lo, A.begin() + hi, R.begin() + pad);
+		A.swap(R);
+		B.assign(A.size(), 0);
+		lo = pad;
+		hi = pad + len;
+	};
+
+	A = { grid };
+	hi = 1;
+	grow();
+
+	for (int t = 0; t < minutes; t++) {
+		// Reads reach one level below lo - 1, and up to a whole
+		// vector past hi
+		if (lo < 2 || hi + LANES + 2 > A.size()) grow();
+
+		for (size_t i = lo - 1; i < hi + 1; i += LANES) {
+			vec_t inner, g, outer;
+			memcpy(&inner, &A[i - 1], sizeof(vec_t));
+			memcpy(&g,     &A[i],     sizeof(vec_t));
+			memcpy(&outer, &A[i + 1], sizeof(vec_t));
+			g = next(inner, g, outer);
+			memcpy(&B[i], &g, sizeof(vec_t));
 		}
+
+		A.swap(B);
+		lo -= A[lo - 1] != 0;
+		hi += A[hi] != 0;
+	}
+
+	// Count the bits
+	int64_t bugs = 0;
+	for (size_t i = lo; i < hi; i++) {
+		bugs += __builtin_popcountll(A[i]);
 	}
+	return bugs;
+}
 
-	int part1 = 0, part2 = 0;
+namespace {
 
-	// Iterate until repeat
-	std::unordered_set<uint64_t> S;
-	for (uint64_t g = grid; ; g = next(g)) {
-		auto [ it, ok ] = S.insert(g);
-		if (!ok) {
-			part1 = even_bits(g);
-			break;
+// Board of any size for the generic engine, one bit per cell, with
+// each row padded to a whole number of 64-bit words.  An extra row
+// past the bottom stays empty, as the neighbors beyond either edge.
+struct board {
+	int W, H, S;
+	std::vector<uint64_t> B;
+
+	board(int W = 0, int H = 0) :
+		W(W), H(H), S((W + 63) / 64), B(size_t(S) * (H + 1))
+	{
+	}
+
+	uint64_t * row(int y) { return &B[size_t(y) * S]; }
+	const uint64_t * row(int y) const { return &B[size_t(y) * S]; }
+	const uint64_t * zero() const { return row(H); }
+
+	bool get(int x, int y) const {
+		return row(y)[x / 64] >> (x % 64) & 1;
+	}
+
+	void set(int x, int y, bool v) {
+		uint64_t &w = row(y)[x / 64], bit = 1ULL << (x % 64);
+		w = v ? w | bit : w & ~bit;
+	}
+
+	bool operator != (const board &o) const {
+		return B != o.B;
+	}
+
+	int64_t count() const {
+		int64_t n = 0;
+		for (auto w : B) n += __builtin_popcountll(w);
+		return n;
+	}
+
+	// Cells past the 64th add multiples of 2^64, which wrap to zero
+	uint64_t biodiversity() const {
+		uint64_t r = 0;
+		for (int i = 0; i < W * H && i < 64; i++) {
+			r |= uint64_t(get(i % W, i / W)) << i;
 		}
+		return r;
 	}
+};
+
+// Step one row with bit-sliced carry-save adders; the four neighbor
+// planes are summed into odd / at-least-two / four bits, the vertical
+// counterpart of sacc().  l and r are the cells beyond each end.
+static void step_row(const board &G, const uint64_t *up, const uint64_t *mid,
+		const uint64_t *down, uint64_t l, uint64_t r, uint64_t *out)
+{
+	int S = G.S;
+	uint64_t last = G.W % 64 ? (1ULL << (G.W % 64)) - 1 : ~0ULL;
+	for (int i = 0; i < S; i++) {
+		uint64_t m = mid[i];
+		uint64_t L = m << 1 | (i ? mid[i - 1] >> 63 : l);
+		uint64_t R = m >> 1 | (i + 1 < S ? mid[i + 1] << 63 : r << ((G.W - 1) % 64));
+		uint64_t U = up[i], D = down[i];
+
+		uint64_t s1 = U ^ D, c1 = U & D;
+		uint64_t s2 = L ^ R, c2 = L & R;
+		uint64_t odd = s1 ^ s2, ge2 = c1 | c2 | (s1 & s2);
+		uint64_t one = odd & ~ge2, two = ~odd & ge2 & ~(c1 & c2);
+
+		out[i] = (one | (~m & two)) & (i + 1 < S ? ~0ULL : last);
+	}
+}
+
+// Part 1 rule on a generic board, split into bands of rows
+static void next(const board &G, board &N) {
+	parallel_for(worker_count(G.H, 256), G.H, [&](int, int begin, int end) {
+		for (int y = begin; y < end; y++) {
+			step_row(G,
+				y ? G.row(y - 1) : G.zero(), G.row(y),
+				y + 1 < G.H ? G.row(y + 1) : G.zero(),
+				0, 0, N.row(y));
+		}
+	});
+}
+
+static void advance(board &G, board &tmp) {
+	next(G, tmp);
+	std::swap(G, tmp);
+}
+
+// Part 2 rule on generic boards, which must have odd dimensions so
+// there is a center cell to recurse into.  Levels are innermost first.
+// Every row of every level is stepped in parallel, then the four cells
+// bordering the center are corrected with their inner-level counts.
+static int64_t recursive(const board &start, int minutes) {
+	int W = start.W, H = start.H, cx = W / 2, cy = H / 2;
+	if (!(W & H & 1)) abort();
+
+	std::vector<board> L = { start }, N;
+	std::vector<uint64_t> Zero(start.S), Ones(start.S, ~0ULL);
+	const board Empty(W, H);
 
-	// Simulate 200 steps, trimming empty grids off the ends
-	// to keep the list from growing unnecessarily
-	std::vector<uint64_t> G = { grid }, N;
-	for (int t = 0; t < 200 && !G.empty(); t++) {
-		uint64_t prev = 0, n;
+	for (int t = 0; t < minutes; t++) {
+		// Output level j is input level j - 1
+		int n = L.size() + 2;
+		N.resize(n, Empty);
+		auto level = [&](int j) -> const board & {
+			return j >= 0 && j < L.size() ? L[j] : Empty;
+		};
 
-		if ((n = next(0, 0, G[0]))) N.push_back(n);
+		size_t rows = size_t(n) * H;
+		parallel_for(worker_count(rows, 256), rows, [&](int, size_t begin, size_t end) {
+			for (size_t k = begin; k < end; k++) {
+				int j = k / H, y = k % H;
+				const board &G = level(j - 1), &O = level(j);
+				auto edge = [&](bool v) { return v ? Ones.data() : Zero.data(); };
+				step_row(G,
+					y ? G.row(y - 1) : edge(O.get(cx, cy - 1)),
+					G.row(y),
+					y + 1 < H ? G.row(y + 1) : edge(O.get(cx, cy + 1)),
+					O.get(cx - 1, cy), O.get(cx + 1, cy),
+					N[j].row(y));
+			}
+		});
 
-		for (int i = 1; i < G.size(); i++) {
-			N.push_back(next(prev, G[i - 1], G[i]));
-			prev = G[i - 1];
+		for (int j = 0; j < n; j++) {
+			const board &I = level(j - 2), &G = level(j - 1), &O = level(j);
+			auto cell = [&](int x, int y) -> int {
+				if (y < 0) return O.get(cx, cy - 1);
+				if (y >= H) return O.get(cx, cy + 1);
+				if (x < 0) return O.get(cx - 1, cy);
+				if (x >= W) return O.get(cx + 1, cy);
+				return G.get(x, y);
+			};
+			auto fix = [&](int x, int y, int inner) {
+				int c = cell(x - 1, y) + cell(x + 1, y) +
+					cell(x, y - 1) + cell(x, y + 1) + inner;
+				N[j].set(x, y, c == 1 || (c == 2 && !G.get(x, y)));
+			};
+
+			int top = 0, bottom = 0, left = 0, right = 0;
+			for (int i = 0; i < I.S; i++) {
+				top    += __builtin_popcountll(I.row(0)[i]);
+				bottom += __builtin_popcountll(I.row(H - 1)[i]);
+			}
+			for (int y = 0; y < H; y++) {
+				left  += I.get(0, y);
+				right += I.get(W - 1, y);
+			}
+
+			fix(cx, cy - 1, top);
+			fix(cx, cy + 1, bottom);
+			fix(cx - 1, cy, left);
+			fix(cx + 1, cy, right);
+			N[j].set(cx, cy, 0);
 		}
 
-		N.push_back(next(prev, G.back(), 0));
-		if ((n = next(G.back(), 0, 0))) N.push_back(n);
+		// Trim empty levels off the ends
+		if (!N.back().count()) N.pop_back();
+		if (!N.front().count()) N.erase(N.begin());
+		L.swap(N);
+	}
+
+	int64_t bugs = 0;
+	for (auto &G : L) bugs += G.count();
+	return bugs;
+}
 
-		G.swap(N);
-		N.clear();
+}
+
+output_t day24(input_t in) {
+	// Represent the grid as a bit field, 2 bits per cell; the generic
+	// engine takes over for any size but 5x5
+	uint64_t grid = 0, b = 1;
+	std::vector<bool> Cell;
+	int W = 0;
+	for (; in.len--; in.s++) {
+		switch (*in.s) {
+		    case '#': grid |= b;
+		    case '.': b <<= 2;
+			Cell.push_back(*in.s == '#');
+			break;
+		    case '\n':
+			if (!W) W = Cell.size();
+		}
 	}
+	if (!W) W = Cell.size();
+	int H = W ? Cell.size() / W : 0;
 
-	// Count the bits
-	for (auto g : G) {
-		part2 += __builtin_popcountll(g);
+	if (W == 5 && H == 5) {
+		int part1 = even_bits(first_repeat(grid));
+		int part2 = recursive(grid, 200);
+		return { part1, part2 };
 	}
 
-	return { part1, part2 };
+	board G(W, H);
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			G.set(x, y, Cell[y * W + x]);
+		}
+	}
+
+	// Large boards can take a very long time to repeat.  The rating is
+	// taken modulo 2^64, so print it unsigned.
+	uint64_t part1 = first_repeat(G).biodiversity();
+
+	// Recursion needs a center cell; reported as 0 without one
+	int64_t part2 = W & H & 1 ? recursive(G, 200) : 0;
+
+	return { std::to_string(part1), part2 };
 }
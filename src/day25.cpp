@@ -81,15 +81,6 @@ struct solver {
 		recv(tmp);
 	}
 
-	void drop(const std::string &s) {
-		send("drop ");
-		send(s);
-		send("\n");
-		std::string tmp;
-		recv(tmp);
-		recv(tmp);
-	}
-
 	void parse_room() {
 		std::string tmp;
 		R.reset();
@@ -160,34 +151,67 @@ struct solver {
 		return { missing, child_sec };
 	}
 
-	int attempt() {
-		std::string tmp;
-		send(MOVE[goal_room]);
-		recv(tmp); // Pressure-sensitive floor
-		recv(tmp); // Analyzing
-		recv(tmp); // Doors here lead
-		recv(tmp); // - direction
-		recv(tmp);
-		char which = tmp[59];
+	// Start of the floor's verdict, which is the first line after its
+	// only door, or npos if not printed yet
+	static size_t verdict_line(const std::string &out) {
+		auto line = out.find("\n- ");
+		if (line == std::string::npos) return line;
+		line = out.find('\n', line + 1);
+		if (line == std::string::npos) return line;
+		return out.find_first_not_of('\n', line);
+	}
+
+	// Type a whole batch of commands into a VM that is waiting for
+	// input, collecting all output until it waits again or halts.
+	// A VM stepping onto the floor can instead stop at a failing
+	// verdict, skipping the ejection back to the checkpoint.
+	static int converse(cpu_t &V, const std::string &cmds, std::string &out, bool floor = false) {
+		int status = cpu_t::S_IN;
+		out.clear();
+		for (auto c : cmds) {
+			*V.input = c;
+			while ((status = V.run()) == cpu_t::S_OUT) {
+				out.push_back(char(V.output));
+				if (floor && V.output == '\n') {
+					auto line = verdict_line(out);
+					if (line != std::string::npos &&
+					    line + 59 < out.size() && out[line + 59] != 'e') {
+						return status;
+					}
+				}
+			}
+			if (status == cpu_t::S_HLT) break;
+		}
+		return status;
+	}
+
+	// Outcome of stepping onto the pressure-sensitive floor: -1 if
+	// too light, 1 if too heavy, or 0 and the keycode if accepted
+	static int verdict(const std::string &out, int64_t &keycode) {
+		auto line = verdict_line(out);
+		if (line == std::string::npos) abort();
+		char which = out[line + 59];
 		if (which == 'e') {
-			recv(tmp);
-			recv(tmp);
-			for (auto k : tmp) {
+			for (auto k : out.substr(out.find('\n', line))) {
 				uint8_t c = k - '0';
-				if (c < 10) R.keycode = 10 * R.keycode + c;
+				if (c < 10) keycode = 10 * keycode + c;
 			}
 			return 0;
 		}
-		for (;;) {
-			recv(tmp);
-			if (tmp[0] == 'C') break;
-		}
 		if (which == 'h') return -1;
 		if (which == 'l') return 1;
 		abort();
 		return 0;
 	}
 
+	// Commands to change inventory from one set of items to another
+	std::string commands(int from, int to) {
+		std::string cmds;
+		for (auto i : bits(from & ~to)) cmds += "drop " + inv[i] + "\n";
+		for (auto i : bits(~from & to)) cmds += "take " + inv[i] + "\n";
+		return cmds;
+	}
+
 	void solve() {
 		// Return to the security room
 		while (!sec_path.empty()) {
@@ -196,30 +220,51 @@ struct solver {
 			sec_path.pop_back();
 		}
 
+		// Wait at the checkpoint for the first command
+		while (status != cpu_t::S_IN) run();
+
 		int unknown = 0xff, have = 0xff, keep = 0x00;
+		std::string out;
 
 		// Switch up inventory
 		auto choose = [&](int want) {
-			for (auto i : bits(have & ~want)) drop(inv[i]);
-			for (auto i : bits(~have & want)) take(inv[i]);
+			status = converse(C, commands(have, want), out);
 			have = want;
 		};
 
-		// Check weight of specified items, plus kept items
-		auto check = [&](int want) {
-			want |= keep;
-			auto &M = weights[want];
-			if (!M) {
-				choose(want);
-				M = attempt();
-				if (M == 1) {
+		/* Weigh several sets of items at once.  The VM standing at
+		 * the checkpoint is the snapshot; each set is weighed on a
+		 * copy of it, so only the difference from the carried items
+		 * needs to be typed in, and the copies can run on separate
+		 * threads.
+		 */
+		auto weigh = [&](const std::vector<int> &sets) {
+			std::vector<int> todo;
+			for (auto want : sets) {
+				if (!weights[want]) todo.push_back(want);
+			}
+
+			parallel_for(worker_count(todo.size(), 2), todo.size(), [&](int, size_t begin, size_t end) {
+				cpu_t V({ }, 0);
+				std::string text;
+				int64_t keycode = 0;
+				for (size_t k = begin; k < end; k++) {
+					V.restore(C);
+					converse(V, commands(have, todo[k]) + MOVE[goal_room], text, true);
+					if (!(weights[todo[k]] = verdict(text, keycode))) {
+						R.keycode = keycode;
+					}
+				}
+			});
+
+			for (auto want : todo) {
+				if (weights[want] == 1) {
 					// Propagate memoization by +1 item
 					for (auto i : bits(0xff ^ want)) {
 						weights[want | (1 << i)] = 1;
 					}
 				}
 			}
-			return M;
 		};
 
 		/* The solution always includes exactly 4 of the 8 items
@@ -242,36 +287,42 @@ struct solver {
 		 * The following algorithm iteratively removes groups
 		 * of leading 0-bits and 1-bits from this number.
 		 */
-		do {
-			/* Pick up one unknown item at a time.  If our weight
-			 * goes over the threshold, we can discard that item,
-			 * because we know it cannot be part of the solution.
+		for (;;) {
+			/* Carrying only the kept items, pick up one unknown
+			 * item at a time.  If our weight goes over the
+			 * threshold, we can discard that item, because we
+			 * know it cannot be part of the solution.
 			 */
+			choose(keep);
+			std::vector<int> sets;
+			for (auto i : bits(unknown)) sets.push_back(keep | 1 << i);
+			weigh(sets);
 			for (auto i : bits(unknown)) {
-				auto c = check(1 << i);
-				if (c <= 0) {
-					if (!c) return;
-					continue;
-				}
-				unknown ^= 1 << i;
+				auto c = weights[keep | 1 << i];
+				if (!c) return;
+				if (c > 0) unknown ^= 1 << i;
 			}
 
-			/* Pick up all unknown items, then drop one at
-			 * at a time (always picking an item back up before
-			 * dropping the next.)  If dropping an item causes
-			 * our weight to go under the threshold, we keep
-			 * the item as part of the solution.
+			/* Pick up all unknown items, then drop one at a
+			 * time.  If dropping an item causes our weight to go
+			 * under the threshold, we keep the item as part of
+			 * the solution.  The set with nothing dropped decides
+			 * whether another round is needed.
 			 */
+			choose(keep | unknown);
+			sets = { have };
+			for (auto i : bits(unknown)) sets.push_back(have ^ 1 << i);
+			weigh(sets);
 			for (auto i : bits(unknown)) {
-				auto c = check(unknown ^ (1 << i));
-				if (c >= 0) {
-					if (!c) return;
-					continue;
+				auto c = weights[have ^ 1 << i];
+				if (!c) return;
+				if (c < 0) {
+					unknown ^= 1 << i;
+					keep |= 1 << i;
 				}
-				unknown ^= 1 << i;
-				keep |= 1 << i;
 			}
-		} while (check(unknown) != 0);
+			if (!weights[have]) return;
+		}
 	}
 };
 
@@ -7,7 +7,7 @@
 #include "advent2019.h"
 
 // Allows solutions to read past the end of the input safely
-static constexpr size_t BACKSPLASH_SIZE = 1 << 20;
+static constexpr size_t BACKSPLASH_SIZE = 1 << 26;
 
 static const std::vector<advent_t> advent2019 = {
 	{ day01 }, { day02 }, { day03 }, { day04 }, { day05 },
@@ -25,6 +25,9 @@ int main() {
 
 	printf("          Time        Part 1           Part 2\n");
 	printf("=======================================================\n");
+#ifdef STATS
+	uint64_t total_steps = 0;
+#endif
 	for (int day = 1; day <= advent2019.size(); day++) {
 		auto &A = advent2019[day - 1];
 		if (!A.fn) continue;
@@ -33,6 +36,10 @@ int main() {
 		sprintf(filename, "input/day%02d.txt", day);
 
 		auto input = load_input(filename);
+#ifdef STATS
+		intcode_steps = 0;
+		stats.clear();
+#endif
 		auto t0 = std::chrono::steady_clock::now();
 		auto output = A.fn(input);
 		auto elapsed = std::chrono::steady_clock::now() - t0;
@@ -46,9 +53,19 @@ int main() {
 				t,
 				output.part1.c_str(),
 				output.part2.c_str());
+#ifdef STATS
+		if (uint64_t n = intcode_steps) {
+			printf("        %9lu Intcode instructions\n", n);
+			total_steps += n;
+		}
+		printf("%s", stats.c_str());
+#endif
 	}
 	printf("=======================================================\n");
 	printf("Total:  %6.f μs\n", total_time);
+#ifdef STATS
+	printf("        %9lu Intcode instructions\n", total_steps);
+#endif
 
 	return 0;
 }